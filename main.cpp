@@ -1,6 +1,7 @@
 #include "ir.hpp"
 #include "repl.hpp"
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 
@@ -33,6 +34,37 @@ public:
                 output.dump_bytecode_file = get_current_arg();
                 continue;
             }
+            if (get_current_arg() == "--gc-pause-budget") {
+                std::string usage = "Usage: luaxc <file> --gc-pause-budget <microseconds>; "
+                                    "Bounds the marking slices of full collections only, "
+                                    "minor collections and the final sweep still stop the world.";
+                advance(usage + " Expected a pause budget!");
+                output.gc_pause_budget = parse_number("--gc-pause-budget", usage);
+                continue;
+            }
+            if (get_current_arg() == "--gc-percent") {
+                std::string usage = "Usage: luaxc <file> --gc-percent <percent>;";
+                advance(usage + " Expected a heap growth percentage!");
+                output.has_gc_percent = true;
+                output.gc_percent = parse_number("--gc-percent", usage);
+                continue;
+            }
+            if (get_current_arg() == "--heap-profile") {
+                advance("Usage: luaxc <file> --heap-profile <output file>; Expected a profile file!");
+                output.has_heap_profile = true;
+                output.heap_profile_file = get_current_arg();
+                continue;
+            }
+            if (get_current_arg() == "--gc-stats") {
+                output.gc_stats = true;
+                continue;
+            }
+            if (get_current_arg() == "--gc-threads") {
+                std::string usage = "Usage: luaxc <file> --gc-threads <count>;";
+                advance(usage + " Expected a thread count!");
+                output.gc_threads = parse_number("--gc-threads", usage);
+                continue;
+            }
         }
     }
 
@@ -43,6 +75,17 @@ public:
         std::string included_path;
         bool dump_bytecode = false;
         std::string dump_bytecode_file;
+        size_t gc_pause_budget = 0;
+        // 0 keeps the collector's default
+        size_t gc_threads = 0;
+        // overrides LUAXC_GC_PERCENT
+        bool has_gc_percent = false;
+        size_t gc_percent = 0;
+        // written when the program exits, also after an error
+        bool has_heap_profile = false;
+        std::string heap_profile_file;
+        // prints a summary of the collector's pauses to stderr when the program exits
+        bool gc_stats = false;
     } output;
 
 private:
@@ -61,6 +104,26 @@ private:
     bool can_advance() const { return idx < argc - 1; }
 
     std::string get_current_arg() const { return argv[idx]; }
+
+    // the current arg as a plain decimal number, without sign, blanks or suffix
+    size_t parse_number(const std::string& flag, const std::string& usage) const {
+        auto arg = get_current_arg();
+
+        size_t value = 0;
+        bool valid = !arg.empty();
+        for (auto c: arg) {
+            if (c < '0' || c > '9' || value > (SIZE_MAX - (c - '0')) / 10) {
+                valid = false;
+                break;
+            }
+            value = value * 10 + (c - '0');
+        }
+
+        if (!valid) {
+            throw std::runtime_error(usage + " Invalid number for " + flag + ": '" + arg + "'");
+        }
+        return value;
+    }
 };
 
 int main(int argc, char** argv) {
@@ -94,6 +157,13 @@ int main(int argc, char** argv) {
         if (parser.output.has_included_path) {
             runtime.get_runtime_context().import_path = parser.output.included_path;
         }
+        runtime.get_gc().set_pause_budget(parser.output.gc_pause_budget);
+        if (parser.output.has_gc_percent) {
+            runtime.get_gc().set_gc_percent(parser.output.gc_percent);
+        }
+        if (parser.output.gc_threads > 0) {
+            runtime.get_gc().set_worker_count(parser.output.gc_threads);
+        }
 
         std::string input_file = parser.output.file;
         std::fstream input_file_stream(input_file);
@@ -104,7 +174,7 @@ int main(int argc, char** argv) {
         runtime.compile(input_file_contents);
 
         if (parser.output.dump_bytecode) {
-            auto byte_code = luaxc::dump_bytecode(runtime.get_byte_code());
+            auto byte_code = luaxc::dump_bytecode(runtime.get_byte_code(), runtime.get_constant_tables());
             std::string dump_file_name = parser.output.dump_bytecode_file + ".dump";
             std::ofstream dump_file(dump_file_name);
             dump_file << byte_code;
@@ -114,7 +184,27 @@ int main(int argc, char** argv) {
             return 0;
         }
 
-        runtime.run();
+        auto report_at_exit = [&] {
+            if (parser.output.gc_stats) {
+                runtime.get_gc().get_telemetry().write_summary(std::cerr);
+            }
+            if (parser.output.has_heap_profile) {
+                runtime.write_heap_profile(parser.output.heap_profile_file);
+            }
+        };
+
+        if (parser.output.has_heap_profile) {
+            runtime.start_heap_profile();
+        }
+
+        try {
+            runtime.run();
+        } catch (...) {
+            // most wanted when the heap limit was hit
+            report_at_exit();
+            throw;
+        }
+        report_at_exit();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__GLIBC__) || defined(__linux__)
+#include <malloc.h>
+#define __LUAXC_USABLE_SIZE(_block) malloc_usable_size(const_cast<void*>(_block))
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define __LUAXC_USABLE_SIZE(_block) malloc_size(_block)
+#elif defined(_WIN32)
+#include <malloc.h>
+#define __LUAXC_USABLE_SIZE(_block) _msize(const_cast<void*>(_block))
+#endif
+
+
+namespace luaxc {
+    // what the allocator really spends on blocks, so that heap accounting follows the resident size.
+    // blocks from malloc and new are asked about directly, the per-block header included.
+    // blocks that cannot be reached, like the nodes of a hash map, are estimated from their request.
+
+    // bookkeeping malloc keeps in front of every block
+    constexpr size_t malloc_block_overhead = sizeof(size_t);
+
+    inline size_t estimated_allocation_size(size_t requested) {
+        constexpr size_t alignment = 2 * sizeof(size_t);
+        constexpr size_t min_block_size = 4 * sizeof(size_t);
+
+        auto size = (requested + malloc_block_overhead + alignment - 1) / alignment * alignment;
+        return size < min_block_size ? min_block_size : size;
+    }
+
+    // `block` must come from malloc or a non-array new, `requested` is used where the allocator cannot be asked
+    inline size_t allocated_size(const void* block, size_t requested) {
+        if (block == nullptr) {
+            return 0;
+        }
+#ifdef __LUAXC_USABLE_SIZE
+        (void) requested;
+        return __LUAXC_USABLE_SIZE(block) + malloc_block_overhead;
+#else
+        return estimated_allocation_size(requested);
+#endif
+    }
+
+    template<typename T>
+    size_t allocated_size(const std::vector<T>& vector) {
+        return vector.capacity() > 0 ? allocated_size(vector.data(), vector.capacity() * sizeof(T)) : 0;
+    }
+
+    template<typename Key, typename T, typename Hash, typename KeyEqual>
+    size_t allocated_size(const std::unordered_map<Key, T, Hash, KeyEqual>& map) {
+        // a node holds the next pointer, the element and its cached hash
+        constexpr size_t node_size = sizeof(void*) + sizeof(std::pair<const Key, T>) + sizeof(size_t);
+
+        // a single bucket is kept inside the map
+        auto buckets = map.bucket_count() > 1 ? estimated_allocation_size(map.bucket_count() * sizeof(void*)) : 0;
+        return buckets + map.size() * estimated_allocation_size(node_size);
+    }
+}// namespace luaxc
+
+#undef __LUAXC_USABLE_SIZE
@@ -1,10 +1,296 @@
 #include "gc.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
 
 namespace luaxc {
+    GCWorkerPool::GCWorkerPool(size_t worker_count) {
+        for (size_t index = 1; index < worker_count; index++) {
+            threads.emplace_back(&GCWorkerPool::work, this, index);
+        }
+    }
+
+    GCWorkerPool::~GCWorkerPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+
+    void GCWorkerPool::run(const std::function<void(size_t)>& task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            this->task = &task;
+            running = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        try {
+            task(0);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this] { return running == 0; });
+        this->task = nullptr;
+
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+
+    void GCWorkerPool::work(size_t index) {
+        size_t seen = 0;
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+
+            auto* current = task;
+            guard.unlock();
+            try {
+                (*current)(index);
+            } catch (...) {
+                guard.lock();
+                if (!error) {
+                    error = std::current_exception();
+                }
+                guard.unlock();
+            }
+            guard.lock();
+
+            if (--running == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    GCHeap::~GCHeap() {
+        for (auto* page: pages) {
+            for (size_t word = 0; word < bitmap_words; word++) {
+                auto live = page->live_bits[word];
+                while (live) {
+                    auto bit = __builtin_ctzll(live);
+                    live &= live - 1;
+
+                    page->cell_at(word * 64 + bit)->~GCObject();
+                }
+            }
+
+            page->~Page();
+            std::free(page);
+        }
+    }
+
+    GCHeap::Page* GCHeap::allocate_page(size_t size_class) {
+        void* memory = std::aligned_alloc(page_size, page_size);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        auto* page = new (memory) Page();
+        page->size_class = size_class;
+        page->cell_size = (size_class + 1) * cell_granularity;
+        page->cell_count = (page_size - cells_offset()) / page->cell_size;
+
+        pages.push_back(page);
+        available[size_class].push_back(page);
+
+        return page;
+    }
+
+    void GCHeap::release_page(Page* page) {
+        page->~Page();
+        std::free(page);
+    }
+
+    void* GCHeap::allocate(size_t size) {
+        assert(size <= max_cell_size);
+
+        auto size_class = select_size_class(size);
+        auto& candidates = available[size_class];
+
+        while (!candidates.empty() && candidates.back()->is_full()) {
+            candidates.pop_back();
+        }
+
+        auto* page = candidates.empty() ? allocate_page(size_class) : candidates.back();
+
+        void* cell;
+        if (page->free_list != nullptr) {
+            cell = page->free_list;
+            page->free_list = *static_cast<void**>(cell);
+        } else {
+            cell = page->cell_at(page->bump_index++);
+        }
+
+        set_bit(page->live_bits, page->index_of(cell));
+        page->live_count++;
+        object_count++;
+
+        return cell;
+    }
+
+    void GCHeap::deallocate(void* cell) {
+        free_cell(page_of(cell), cell);
+        object_count--;
+    }
+
+    void GCHeap::free_cell(Page* page, void* cell) {
+        auto index = page->index_of(cell);
+
+        page->live_bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+        page->live_count--;
+
+        *static_cast<void**>(cell) = page->free_list;
+        page->free_list = cell;
+    }
+
+    bool GCHeap::mark(const GCObject* object) {
+        auto* page = page_of(object);
+        return set_bit(page->mark_bits, page->index_of(object));
+    }
+
+    bool GCHeap::mark_atomically(const GCObject* object) {
+        auto* page = page_of(object);
+        auto index = page->index_of(object);
+        auto bit = uint64_t(1) << (index % 64);
+
+        // a plain load first, most children seen by a worker are marked already
+        auto& word = page->mark_bits[index / 64];
+        if (__atomic_load_n(&word, __ATOMIC_RELAXED) & bit) {
+            return false;
+        }
+        return !(__atomic_fetch_or(&word, bit, __ATOMIC_RELAXED) & bit);
+    }
+
+    bool GCHeap::remember(const GCObject* object) {
+        auto* page = page_of(object);
+        return set_bit(page->remembered_bits, page->index_of(object));
+    }
+
+    void GCHeap::clear_marks() {
+        for (auto* page: pages) {
+            std::fill(std::begin(page->mark_bits), std::end(page->mark_bits), 0);
+        }
+    }
+
+    void GCHeap::mark_old_objects() {
+        for (auto* page: pages) {
+            std::copy(std::begin(page->old_bits), std::end(page->old_bits), std::begin(page->mark_bits));
+        }
+    }
+
+    void GCHeap::sweep_page(Page* page, SweepResult& result, HeapProfiler* profiler) {
+        for (size_t word = 0; word < bitmap_words; word++) {
+            auto dead = page->live_bits[word] & ~page->mark_bits[word];
+            while (dead) {
+                auto bit = __builtin_ctzll(dead);
+                dead &= dead - 1;
+
+                auto* object = page->cell_at(word * 64 + bit);
+                if (object->no_collect) {
+                    continue;
+                }
+
+                result.freed_objects++;
+                result.freed_bytes += object->accounted_size;
+
+                if (profiler) {
+                    profiler->record_free(object);
+                }
+
+                object->~GCObject();
+                free_cell(page, object);
+            }
+        }
+
+        std::copy(std::begin(page->live_bits), std::end(page->live_bits), std::begin(page->old_bits));
+        std::fill(std::begin(page->remembered_bits), std::end(page->remembered_bits), 0);
+    }
+
+    GCHeap::SweepResult GCHeap::sweep(GCWorkerPool* workers, HeapProfiler* profiler) {
+        SweepResult result;
+
+        if (workers != nullptr) {
+            assert(profiler == nullptr);
+
+            // workers claim a few pages at a time
+            constexpr size_t pages_per_claim = 8;
+
+            std::atomic<size_t> next_page{0};
+            std::vector<SweepResult> results(workers->size());
+
+            workers->run([&](size_t self) {
+                auto& swept = results[self];
+                while (true) {
+                    auto begin = next_page.fetch_add(pages_per_claim);
+                    if (begin >= pages.size()) {
+                        break;
+                    }
+
+                    auto end = std::min(begin + pages_per_claim, pages.size());
+                    for (auto i = begin; i < end; i++) {
+                        sweep_page(pages[i], swept, nullptr);
+                    }
+                }
+            });
+
+            for (auto& swept: results) {
+                result.freed_objects += swept.freed_objects;
+                result.freed_bytes += swept.freed_bytes;
+            }
+        } else {
+            for (auto* page: pages) {
+                sweep_page(page, result, profiler);
+            }
+        }
+        object_count -= result.freed_objects;
+
+        size_t kept = 0;
+        for (auto* page: pages) {
+            if (page->live_count == 0) {
+                release_page(page);
+            } else {
+                pages[kept++] = page;
+            }
+        }
+        pages.resize(kept);
+        old_object_count = object_count;
+
+        for (auto& candidates: available) {
+            candidates.clear();
+        }
+
+        for (auto* page: pages) {
+            if (!page->is_full()) {
+                available[page->size_class].push_back(page);
+            }
+        }
+
+        return result;
+    }
+
     GarbageCollector::~GarbageCollector() {
-        for (auto* object: gc_objects) {
+        for (auto* object: foreign_objects) {
             if (!object->no_collect) {
                 delete object;
             }
@@ -12,16 +298,263 @@ namespace luaxc {
     }
 
     void GarbageCollector::collect() {
-        for (auto* object: gc_objects) {
+        auto started = Clock::now();
+
+        if (!marking) {
+            begin_marking();
+        }
+
+        // an incremental cycle in progress is finished in one go
+        if (auto* pool = parallel_workers()) {
+            drain_gray_objects_in_parallel(*pool);
+        } else {
+            drain_gray_objects();
+        }
+        finish_full_collection();
+
+        record_pause(started);
+    }
+
+    void GarbageCollector::collect_minor() {
+        auto started = Clock::now();
+        begin_collection(false);
+
+        heap.mark_old_objects();
+
+        mark_from_roots();
+
+        for (auto* object: remembered_objects) {
+            mark_children(object);
+        }
+
+        for (auto& frame: remembered_frames) {
+            mark_frame(frame->get_frame());
+        }
+
+        for (size_t i = young_foreign_begin; i < foreign_objects.size(); i++) {
+            mark_children(foreign_objects[i]);
+        }
+
+        for (size_t i = young_immortal_root_begin; i < immortal_roots.size(); i++) {
+            mark_children(immortal_roots[i]);
+        }
+
+        drain_gray_objects();
+
+        statistics.alloc_count = 0;
+
+        auto young_bytes = statistics.bytes_allocated - statistics.bytes_after_collection;
+        auto young_objects = get_mortal_object_count() - statistics.mortal_objects_after_collection;
+        auto swept = sweep_heap();
+
+        forget_remembered_set();
+        pace_after_minor(young_bytes);
+        statistics.minor_collections++;
+        finish_collection(young_objects, young_bytes, swept);
+
+        record_pause(started);
+    }
+
+    void GarbageCollector::begin_marking() {
+        begin_collection(true);
+        heap.clear_marks();
+
+        for (auto* object: foreign_objects) {
             object->marked = false;
         }
 
+        // the snapshot, everything reachable from here is kept by this cycle
         mark_from_roots();
+        for (auto* object: immortal_roots) {
+            mark_children(object);
+        }
+        marking = true;
+    }
+
+    void GarbageCollector::mark_slice() {
+        auto started = Clock::now();
+        auto deadline = started + std::chrono::microseconds(config.pause_budget);
+
+        // the clock is only read every few objects
+        constexpr size_t objects_per_clock_check = 32;
+
+        statistics.alloc_count = 0;
+
+        while (!gray_objects.empty()) {
+            for (size_t i = 0; i < objects_per_clock_check && !gray_objects.empty(); i++) {
+                auto* object = gray_objects.back();
+                gray_objects.pop_back();
+                mark_children(object);
+            }
+
+            if (Clock::now() >= deadline) {
+                record_pause(started);
+                return;
+            }
+        }
+
+        finish_full_collection();
+        record_pause(started);
+    }
+
+    void GarbageCollector::finish_full_collection() {
+        assert(gray_objects.empty());
+        marking = false;
 
-        statistics.last_object_count = gc_objects.size();
         statistics.alloc_count = 0;
 
-        sweep();
+        auto objects = get_mortal_object_count();
+        auto bytes = statistics.bytes_allocated;
+        auto swept = sweep();
+
+        forget_remembered_set();
+        pace_after_full();
+        statistics.full_collections++;
+        finish_collection(objects, bytes, swept);
+    }
+
+    void GarbageCollector::begin_collection(bool full) {
+        auto elapsed = std::chrono::duration<double>(Clock::now() - statistics.last_collection_end).count();
+        auto allocated = statistics.total_allocated - statistics.allocated_at_last_collection;
+
+        collection = {};
+        collection.full = full;
+        collection.allocation_rate = elapsed > 0 ? allocated / elapsed : 0.0;
+    }
+
+    void GarbageCollector::finish_collection(size_t objects, size_t bytes, const GCHeap::SweepResult& swept) {
+        collection.freed_objects = swept.freed_objects;
+        collection.freed_bytes = swept.freed_bytes;
+        collection.marked_objects = objects - std::min(objects, swept.freed_objects);
+        collection.marked_bytes = bytes - std::min(bytes, swept.freed_bytes);
+        collection.survival_ratio = bytes > 0 ? double(collection.marked_bytes) / bytes : 0.0;
+        collection_finished = true;
+
+        statistics.allocated_at_last_collection = statistics.total_allocated;
+        statistics.mortal_objects_after_collection = get_mortal_object_count();
+    }
+
+    void GarbageCollector::record_pause(Clock::time_point started) {
+        auto now = Clock::now();
+        auto pause = std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+
+        statistics.last_pause = pause;
+        statistics.max_pause = std::max<size_t>(statistics.max_pause, pause);
+
+        telemetry.record_pause(pause);
+        collection.pause += pause;
+        if (collection_finished) {
+            telemetry.record_collection(collection);
+            collection_finished = false;
+            statistics.last_collection_end = now;
+        }
+    }
+
+    void GarbageCollector::forget_remembered_set() {
+        remembered_objects.clear();
+        remembered_frames.clear();
+
+        young_foreign_begin = foreign_objects.size();
+        young_immortal_root_begin = immortal_roots.size();
+    }
+
+    namespace {
+        // immortal objects that only reference other immortal ones, like the type of a string, are not roots
+        struct MortalReferenceFinder final : GCVisitor {
+            bool found = false;
+
+            void visit(GCObject* object) override {
+                found = found || (object != nullptr && GarbageCollector::is_mortal(object));
+            }
+        };
+    }// namespace
+
+    void GarbageCollector::regist_no_collect(GCObject* object) {
+        object->no_collect = true;
+
+        auto [it, inserted] = immortal_objects.emplace(object, false);
+        if (!inserted) {
+            return;
+        }
+
+        MortalReferenceFinder finder;
+        object->trace(finder);
+        if (finder.found) {
+            it->second = true;
+            immortal_roots.push_back(object);
+        }
+    }
+
+    void GarbageCollector::trace_as_immortal_root(GCObject* object) {
+        auto it = immortal_objects.find(object);
+        if (it == immortal_objects.end() || it->second) {
+            return;
+        }
+
+        it->second = true;
+        immortal_roots.push_back(object);
+    }
+
+    size_t GarbageCollector::gc_percent_from_environment() {
+        constexpr size_t default_gc_percent = 100;
+
+        auto* value = std::getenv("LUAXC_GC_PERCENT");
+        if (value == nullptr) {
+            return default_gc_percent;
+        }
+
+        // strtoul would take blanks and a sign, "-1" wrapping around to a huge percentage
+        char* end = nullptr;
+        auto percent = std::strtoul(value, &end, 10);
+        if (*value < '0' || *value > '9' || *end != '\0') {
+            return default_gc_percent;
+        }
+        return percent;
+    }
+
+    void GarbageCollector::pace_after_minor(size_t young_bytes) {
+        // minor collections only free young objects, whatever is left of them was promoted
+        auto promoted = statistics.bytes_allocated - std::min(statistics.bytes_allocated, statistics.bytes_after_collection);
+        statistics.bytes_after_collection = statistics.bytes_allocated;
+
+        // the more of the young generation survives, the larger the nursery has to be to find the same garbage
+        double survival = young_bytes > 0 ? std::min(double(promoted) / young_bytes, 1.0) : 0.0;
+        auto nursery_size = config.nursery_garbage / std::max(1.0 - survival, 0.125);
+
+        statistics.nursery_size = std::clamp<size_t>(nursery_size, config.min_nursery_size, config.max_nursery_size);
+    }
+
+    void GarbageCollector::pace_after_full() {
+        statistics.bytes_after_collection = statistics.bytes_allocated;
+        statistics.live_bytes_after_full = statistics.bytes_allocated;
+
+        // saturates at the heap limit, huge percentages would wrap the goal around to below the live heap
+        auto limit = std::max(config.max_heap_size, config.min_heap_goal);
+        auto live = statistics.live_bytes_after_full;
+        auto room = limit - std::min(live, limit);
+        auto growth = live / 100;
+        auto goal = config.gc_percent > 0 && growth > room / config.gc_percent ? limit : live + growth * config.gc_percent;
+        statistics.heap_goal = std::clamp(goal, config.min_heap_goal, limit);
+
+        // nothing is known about the survival of objects allocated after a full collection
+        statistics.nursery_size = config.nursery_garbage;
+    }
+
+    void GarbageCollector::collect_by_policy() {
+        if (marking) {
+            mark_slice();
+            return;
+        }
+
+        if (statistics.bytes_allocated < statistics.heap_goal) {
+            collect_minor();
+        } else if (config.pause_budget > 0) {
+            auto started = Clock::now();
+            begin_marking();
+            record_pause(started);
+        } else {
+            collect();
+        }
     }
 
     bool GarbageCollector::should_run_gc() {
@@ -29,15 +562,15 @@ namespace luaxc {
             return false;
         }
 
-        if (statistics.alloc_count >= config.allocation_threshold) {
-            return true;
+        if (marking) {
+            return statistics.alloc_count >= config.slice_interval;
         }
 
-        if (gc_objects.size() >= statistics.last_object_count * config.growth_factor) {
+        if (statistics.bytes_allocated >= statistics.bytes_after_collection + statistics.nursery_size) {
             return true;
         }
 
-        if (statistics.bytes_allocated >= config.memory_threshold) {
+        if (statistics.bytes_allocated >= statistics.heap_goal) {
             return true;
         }
 
@@ -57,40 +590,281 @@ namespace luaxc {
                     mark_object(value.get_inner_value<GCObject*>());
                 }
             }
+
+            // slots of active frames are windows over the op stack, marked above
+
+            // a running closure may no longer be reachable from any value, its upvalues are
+            mark_object(frame.function);
+        }
+
+        if (context_stack != nullptr) {
+            for (auto* ctx: *context_stack) {
+                mark_object(ctx);
+            }
         }
     }
 
+    void GarbageCollector::mark_frame(const StackFrame& frame) {
+        for (auto& [_, value]: frame.variables) {
+            if (value.is_gc_object()) {
+                mark_object(value.get_inner_value<GCObject*>());
+            }
+        }
+
+        for (size_t i = 0; i < frame.slot_count(); i++) {
+            auto& value = frame.slot(i);
+            if (value.is_gc_object()) {
+                mark_object(value.get_inner_value<GCObject*>());
+            }
+        }
+    }
+
+    bool GarbageCollector::try_mark(GCObject* object) {
+        if (object->in_heap) {
+            return GCHeap::mark(object);
+        }
+
+        // immortal, and traced as a root when it holds references
+        if (object->no_collect) {
+            return false;
+        }
+
+        if (object->marked) {
+            return false;
+        }
+
+        object->marked = true;
+        return true;
+    }
+
+    bool GarbageCollector::try_mark_atomically(GCObject* object) {
+        if (object->in_heap) {
+            return GCHeap::mark_atomically(object);
+        }
+
+        if (object->no_collect) {
+            return false;
+        }
+
+        if (__atomic_load_n(&object->marked, __ATOMIC_RELAXED)) {
+            return false;
+        }
+        return !__atomic_exchange_n(&object->marked, true, __ATOMIC_RELAXED);
+    }
+
+    GCWorkerPool* GarbageCollector::parallel_workers() {
+        if (config.worker_count <= 1 || heap.get_page_count() < config.parallel_page_threshold) {
+            return nullptr;
+        }
+
+        if (!workers) {
+            workers = std::make_unique<GCWorkerPool>(config.worker_count);
+        }
+        return workers.get();
+    }
+
     void GarbageCollector::mark_object(GCObject* object) {
         if (object == nullptr) {
             return;
         }
 
-        if (object->marked) {
-            return;
+        if (try_mark(object)) {
+            gray_objects.push_back(object);
         }
+    }
 
-        object->marked = true;
-        for (auto* child: object->get_referenced_objects()) {
-            mark_object(child);
+    // shades the children of a traced object gray
+    struct GarbageCollector::GrayVisitor final : GCVisitor {
+        GarbageCollector& gc;
+
+        explicit GrayVisitor(GarbageCollector& gc) : gc(gc) {}
+
+        void visit(GCObject* object) override { gc.mark_object(object); }
+    };
+
+    void GarbageCollector::mark_children(GCObject* object) {
+        GrayVisitor visitor(*this);
+        object->trace(visitor);
+        account_growth(remeasure(object));
+    }
+
+    size_t GarbageCollector::measure(const GCObject* object) {
+        // objects outside of the heap come from new, their dynamic type is unknown here
+        auto own_size = object->in_heap ? GCHeap::cell_size_of(object) : allocated_size(object, sizeof(GCObject));
+        return own_size + object->get_owned_size();
+    }
+
+    ptrdiff_t GarbageCollector::remeasure(GCObject* object) {
+        if (!is_mortal(object)) {
+            return 0;
         }
+
+        auto previous = object->accounted_size;
+        object->accounted_size = measure(object);
+        return static_cast<ptrdiff_t>(object->accounted_size) - static_cast<ptrdiff_t>(previous);
     }
 
-    void GarbageCollector::sweep() {
-        std::unordered_set<GCObject*> to_sweep;
-        for (auto* object: gc_objects) {
-            if (!object->marked && !object->no_collect) {
-                to_sweep.insert(object);
+    void GarbageCollector::account_growth(ptrdiff_t growth) {
+        statistics.bytes_allocated += growth;
+        if (growth > 0) {
+            statistics.total_allocated += growth;
+        }
+    }
 
-                auto object_size = object->get_object_size();
-                assert(statistics.bytes_allocated >= object_size);
-                // !!
-                statistics.bytes_allocated -= object_size;
-            }
+    void GarbageCollector::drain_gray_objects() {
+        while (!gray_objects.empty()) {
+            auto* object = gray_objects.back();
+            gray_objects.pop_back();
+            mark_children(object);
         }
+    }
+
+    namespace {
+        // gray objects a worker shares with the others, in chunks.
+        // the owner pushes and pops at the back, thieves take from the front.
+        struct MarkDeque {
+            std::mutex lock;
+            std::deque<std::vector<GCObject*>> chunks;
+        };
+    }// namespace
+
+    void GarbageCollector::drain_gray_objects_in_parallel(GCWorkerPool& pool) {
+        constexpr size_t chunk_size = 128;
+
+        std::vector<MarkDeque> deques(pool.size());
 
-        for (auto* object: to_sweep) {
-            delete object;
-            gc_objects.erase(object);
+        // chunks waiting in any deque, and workers that hold or are looking for gray objects
+        std::atomic<size_t> published{0};
+        std::atomic<size_t> active{pool.size()};
+
+        for (size_t begin = 0, i = 0; begin < gray_objects.size(); begin += chunk_size, i++) {
+            auto end = std::min(begin + chunk_size, gray_objects.size());
+            deques[i % deques.size()].chunks.emplace_back(gray_objects.begin() + begin, gray_objects.begin() + end);
+            published++;
+        }
+        gray_objects.clear();
+
+        // the gray objects of one worker, children go to its own stack
+        struct LocalVisitor final : GCVisitor {
+            std::vector<GCObject*> local;
+
+            void visit(GCObject* object) override {
+                if (object != nullptr && try_mark_atomically(object)) {
+                    local.push_back(object);
+                }
+            }
+        };
+
+        // summed up once the workers are done
+        std::atomic<ptrdiff_t> growth{0};
+
+        pool.run([&](size_t self) {
+            LocalVisitor visitor;
+            auto& local = visitor.local;
+            ptrdiff_t local_growth = 0;
+
+            auto take = [&](size_t victim) {
+                auto& deque = deques[victim];
+                std::lock_guard<std::mutex> guard(deque.lock);
+                if (deque.chunks.empty()) {
+                    return false;
+                }
+
+                if (victim == self) {
+                    local = std::move(deque.chunks.back());
+                    deque.chunks.pop_back();
+                } else {
+                    local = std::move(deque.chunks.front());
+                    deque.chunks.pop_front();
+                }
+                published--;
+                return true;
+            };
+
+            auto find_work = [&] {
+                for (size_t i = 0; i < deques.size(); i++) {
+                    if (take((self + i) % deques.size())) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            while (true) {
+                while (!local.empty()) {
+                    auto* object = local.back();
+                    local.pop_back();
+
+                    object->trace(visitor);
+                    local_growth += remeasure(object);
+
+                    // keep the oldest part of a growing worklist where idle workers can steal it
+                    if (local.size() >= chunk_size * 2) {
+                        std::vector<GCObject*> chunk(local.begin(), local.begin() + chunk_size);
+                        local.erase(local.begin(), local.begin() + chunk_size);
+
+                        std::lock_guard<std::mutex> guard(deques[self].lock);
+                        deques[self].chunks.push_back(std::move(chunk));
+                        published++;
+                    }
+                }
+
+                if (find_work()) {
+                    continue;
+                }
+
+                // a worker only goes idle with nothing in hand, so once every worker is idle
+                // all chunks have been taken and marking is done
+                active--;
+                bool found = false;
+                while (!found) {
+                    if (published > 0) {
+                        active++;
+                        found = find_work();
+                        if (!found) {
+                            active--;
+                        }
+                    } else if (active == 0) {
+                        growth += local_growth;
+                        return;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+
+        account_growth(growth);
+    }
+
+    GCHeap::SweepResult GarbageCollector::sweep_heap() {
+        auto swept = profiler ? heap.sweep(nullptr, profiler.get()) : heap.sweep(parallel_workers());
+        assert(statistics.bytes_allocated >= swept.freed_bytes);
+        statistics.bytes_allocated -= swept.freed_bytes;
+        return swept;
+    }
+
+    GCHeap::SweepResult GarbageCollector::sweep() {
+        auto swept = sweep_heap();
+
+        size_t kept = 0;
+        for (auto* object: foreign_objects) {
+            if (!object->marked && !object->no_collect) {
+                assert(statistics.bytes_allocated >= object->accounted_size);
+                statistics.bytes_allocated -= object->accounted_size;
+                swept.freed_objects++;
+                swept.freed_bytes += object->accounted_size;
+
+                if (profiler) {
+                    profiler->record_free(object);
+                }
+
+                delete object;
+            } else {
+                foreign_objects[kept++] = object;
+            }
         }
+        foreign_objects.resize(kept);
+        return swept;
     }
-}// namespace luaxc
\ No newline at end of file
+}// namespace luaxc
@@ -1,12 +1,199 @@
 #pragma once
 
-#include <list>
-#include <unordered_set>
-
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gc_telemetry.hpp"
+#include "heap_profiler.hpp"
 #include "value.hpp"
 
 
 namespace luaxc {
+    // helper threads for the stop-the-world phases of a collection.
+    // the mutator is paused while they run, the calling thread works along as worker 0.
+    class GCWorkerPool {
+    public:
+        explicit GCWorkerPool(size_t worker_count);
+        GCWorkerPool(const GCWorkerPool&) = delete;
+        GCWorkerPool& operator=(const GCWorkerPool&) = delete;
+
+        ~GCWorkerPool();
+
+        size_t size() const { return threads.size() + 1; }
+
+        // runs task(index) once on every worker and waits for all of them.
+        // the first exception thrown by a worker is rethrown here.
+        void run(const std::function<void(size_t)>& task);
+
+    private:
+        void work(size_t index);
+
+        std::vector<std::thread> threads;
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        const std::function<void(size_t)>* task = nullptr;
+        size_t generation = 0;
+        size_t running = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+    };
+
+    // size-class segregated heap backing the collector.
+    // small objects live in fixed-size cells of aligned pages. live and mark bits are kept in the page
+    // header, so marks are cleared and dead cells are found page by page.
+    // objects are never moved. the old generation is the set of cells that survived a sweep, kept in
+    // sticky old bits that seed the mark bits of a minor collection.
+    class GCHeap {
+    public:
+        static constexpr size_t page_size = 64 * 1024;
+        static constexpr size_t cell_granularity = 16;
+        static constexpr size_t max_cell_size = 512;
+        static constexpr size_t size_class_count = max_cell_size / cell_granularity;
+
+        struct SweepResult {
+            size_t freed_objects = 0;
+            size_t freed_bytes = 0;
+        };
+
+        GCHeap() = default;
+        GCHeap(const GCHeap&) = delete;
+        GCHeap& operator=(const GCHeap&) = delete;
+
+        GCHeap(GCHeap&& other) noexcept { *this = std::move(other); }
+
+        // pages of this heap are released by the moved-from one
+        GCHeap& operator=(GCHeap&& other) noexcept {
+            std::swap(pages, other.pages);
+            std::swap(available, other.available);
+            std::swap(object_count, other.object_count);
+            std::swap(old_object_count, other.old_object_count);
+            return *this;
+        }
+
+        ~GCHeap();
+
+        // returns an uninitialized cell that is already counted as live
+        void* allocate(size_t size);
+
+        // gives back a cell whose object was never constructed
+        void deallocate(void* cell);
+
+        static bool mark(const GCObject* object);
+
+        // for marking from several threads at once
+        static bool mark_atomically(const GCObject* object);
+
+        static size_t cell_size_of(const GCObject* object) { return page_of(object)->cell_size; }
+
+        static bool is_old(const GCObject* object) {
+            auto* page = page_of(object);
+            return test_bit(page->old_bits, page->index_of(object));
+        }
+
+        // true the first time an old object is remembered since the last sweep
+        static bool remember(const GCObject* object);
+
+        // full collections start from clear marks
+        void clear_marks();
+
+        // minor collections start with every old object marked, so tracing stops at the old generation
+        void mark_old_objects();
+
+        // destroys unmarked objects that are not pinned by no_collect, and releases empty pages.
+        // every survivor is promoted to the old generation.
+        // pages are swept by every worker of the pool when one is given.
+        // a profiler is told about every object freed, it requires sweeping on the calling thread.
+        SweepResult sweep(GCWorkerPool* workers = nullptr, HeapProfiler* profiler = nullptr);
+
+        size_t get_object_count() const { return object_count; }
+
+        size_t get_old_object_count() const { return old_object_count; }
+
+        size_t get_page_count() const { return pages.size(); }
+
+    private:
+        static constexpr size_t bitmap_words = page_size / cell_granularity / 64;
+
+        struct Page {
+            size_t size_class;
+            size_t cell_size;
+            size_t cell_count;
+            size_t bump_index = 0;
+            size_t live_count = 0;
+
+            // threaded through freed cells
+            void* free_list = nullptr;
+
+            uint64_t live_bits[bitmap_words] = {};
+            uint64_t mark_bits[bitmap_words] = {};
+            uint64_t old_bits[bitmap_words] = {};
+            uint64_t remembered_bits[bitmap_words] = {};
+
+            char* cells() { return reinterpret_cast<char*>(this) + cells_offset(); }
+
+            const char* cells() const { return reinterpret_cast<const char*>(this) + cells_offset(); }
+
+            GCObject* cell_at(size_t index) { return reinterpret_cast<GCObject*>(cells() + index * cell_size); }
+
+            size_t index_of(const void* cell) const {
+                return (static_cast<const char*>(cell) - cells()) / cell_size;
+            }
+
+            bool is_full() const { return free_list == nullptr && bump_index == cell_count; }
+        };
+
+        static constexpr size_t cells_offset() {
+            return (sizeof(Page) + cell_granularity - 1) / cell_granularity * cell_granularity;
+        }
+
+        static Page* page_of(const void* cell) {
+            return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(cell) & ~(uintptr_t) (page_size - 1));
+        }
+
+        static size_t select_size_class(size_t size) { return (size + cell_granularity - 1) / cell_granularity - 1; }
+
+        static bool test_bit(const uint64_t* bits, size_t index) { return bits[index / 64] & (uint64_t(1) << (index % 64)); }
+
+        // returns whether the bit was clear
+        static bool set_bit(uint64_t* bits, size_t index) {
+            auto bit = uint64_t(1) << (index % 64);
+            bool was_clear = !(bits[index / 64] & bit);
+            bits[index / 64] |= bit;
+            return was_clear;
+        }
+
+        Page* allocate_page(size_t size_class);
+
+        // only touches the page, pages can be freed into from different threads
+        static void free_cell(Page* page, void* cell);
+
+        static void sweep_page(Page* page, SweepResult& result, HeapProfiler* profiler);
+
+        void release_page(Page* page);
+
+        std::vector<Page*> pages;
+
+        // pages of each size class that still have free cells
+        std::vector<Page*> available[size_class_count];
+
+        size_t object_count = 0;
+        size_t old_object_count = 0;
+    };
+
     class GarbageCollector {
     public:
         class GCGuard {
@@ -29,17 +216,23 @@ namespace luaxc {
             bool was_gc_enabled;
         };
 
-        GarbageCollector() = default;
+        GarbageCollector() { pace_after_full(); }
         GarbageCollector(std::vector<PrimValue>* op_stack,
-                         std::list<StackFrame>* stack_frame)
-            : op_stack(op_stack), stack_frame(stack_frame) {}
+                         std::vector<StackFrame>* stack_frame,
+                         std::vector<FrozenContextObject*>* context_stack)
+            : op_stack(op_stack), stack_frame(stack_frame), context_stack(context_stack) { pace_after_full(); }
 
         void init(std::vector<PrimValue>* op_stack,
-                  std::list<StackFrame>* stack_frame) {
+                  std::vector<StackFrame>* stack_frame,
+                  std::vector<FrozenContextObject*>* context_stack) {
             this->op_stack = op_stack;
             this->stack_frame = stack_frame;
+            this->context_stack = context_stack;
         }
 
+        GarbageCollector(GarbageCollector&&) = default;
+        GarbageCollector& operator=(GarbageCollector&&) = default;
+
         ~GarbageCollector();
 
         template<typename ObjectType, typename... Args, typename = std::enable_if_t<std::is_base_of_v<GCObject, ObjectType>>>
@@ -49,37 +242,119 @@ namespace luaxc {
             }
 
             if (should_run_gc()) {
-                collect();
+                collect_by_policy();
+            }
+
+            ObjectType* object;
+            if constexpr (sizeof(ObjectType) <= GCHeap::max_cell_size) {
+                void* cell = heap.allocate(sizeof(ObjectType));
+                try {
+                    object = new (cell) ObjectType(std::forward<Args>(args)...);
+                } catch (...) {
+                    heap.deallocate(cell);
+                    throw;
+                }
+                object->in_heap = true;
+            } else {
+                object = new ObjectType(std::forward<Args>(args)...);
+                foreign_objects.push_back(object);
             }
 
-            ObjectType* object = new ObjectType(std::forward<Args>(args)...);
-            gc_objects.insert(object);
+            if (marking) {
+                allocate_black(object);
+            }
 
-            size_t size = object->get_object_size();
+            object->accounted_size = measure(object);
             statistics.alloc_count++;
-            statistics.bytes_allocated += size;
+            statistics.bytes_allocated += object->accounted_size;
+            statistics.total_allocated += object->accounted_size;
+
+            if (profiler) {
+                profiler->record_allocation(object);
+            }
 
             return object;
         }
 
-        void regist_no_collect(GCObject* object) {
-            object->no_collect = true;
-            gc_objects.insert(object);
-            //statistics.bytes_allocated += object->get_object_size();
-        }
+        // moves the object to the immortal space, it is never swept.
+        // immortal objects may be shared between runtimes, and are registered more than once.
+        void regist_no_collect(GCObject* object);
 
+        // heap objects may be pinned for a while, only the ones outside of the heap are immortal
+        static bool is_mortal(const GCObject* object) { return object->in_heap || !object->no_collect; }
+
+        // for objects created with new, prefer allocate
         void regist(GCObject* object) {
             if (statistics.bytes_allocated > config.max_heap_size) {
                 throw std::runtime_error("Heap memory overflow");
             }
 
-            gc_objects.insert(object);
+            // copies of heap objects inherit the flag
+            object->in_heap = false;
+            foreign_objects.push_back(object);
+            if (marking) {
+                allocate_black(object);
+            }
+            object->accounted_size = measure(object);
             statistics.alloc_count++;
-            statistics.bytes_allocated += object->get_object_size();
+            statistics.bytes_allocated += object->accounted_size;
+            statistics.total_allocated += object->accounted_size;
+
+            if (profiler) {
+                profiler->record_allocation(object);
+            }
         }
 
+        // full collection
         void collect();
 
+        // only reclaims objects allocated since the last collection
+        void collect_minor();
+
+        // to be called after storing a value into a heap object.
+        // old objects holding young ones are traced by minor collections.
+        void write_barrier(GCObject* owner, const PrimValue& value) {
+            if (value.is_gc_object()) {
+                write_barrier(owner, value.get_inner_value<GCObject*>());
+            }
+        }
+
+        void write_barrier(GCObject* owner, GCObject* target) {
+            if (owner->no_collect && target && is_mortal(target)) {
+                trace_as_immortal_root(owner);
+            }
+
+            if (!target || !target->in_heap || GCHeap::is_old(target)) {
+                return;
+            }
+
+            if (owner->in_heap) {
+                if (GCHeap::is_old(owner) && GCHeap::remember(owner)) {
+                    remembered_objects.push_back(owner);
+                }
+            } else if (remembered_objects.empty() || remembered_objects.back() != owner) {
+                // objects outside of the heap have no remembered bit, repeated stores may remember them twice
+                remembered_objects.push_back(owner);
+            }
+        }
+
+        // to be called with the value a store into a heap object is about to overwrite.
+        // an incremental cycle keeps everything that was reachable when it started.
+        void deletion_barrier(const PrimValue& overwritten) {
+            if (marking && overwritten.is_gc_object()) {
+                mark_object(overwritten.get_inner_value<GCObject*>());
+            }
+        }
+
+        void deletion_barrier(GCObject* overwritten) {
+            if (marking) {
+                mark_object(overwritten);
+            }
+        }
+
+        // copies made of a returning frame may hold the only references to young objects
+        void remember_frame(const SharedStackFrameRef& frame) { remembered_frames.push_back(frame); }
+
         GCGuard guard() { return GCGuard{this}; }
 
         void set_gc_enabled(bool enabled) { this->enabled = enabled; }
@@ -88,6 +363,42 @@ namespace luaxc {
 
         void set_max_heap_size(size_t size) { config.max_heap_size = size; }
 
+        // in microseconds. full collections are marked incrementally in slices of about this length,
+        // 0 runs them stop-the-world. only marking slices honor the budget, minor collections and the
+        // final atomic sweep of a full collection still pause for as long as they take.
+        void set_pause_budget(size_t budget) { config.pause_budget = budget; }
+
+        size_t get_pause_budget() const { return config.pause_budget; }
+
+        // threads marking and sweeping during a pause, 1 keeps the collector on the calling thread.
+        // helper threads are only started once the heap is large enough to make use of them.
+        void set_worker_count(size_t count) {
+            config.worker_count = std::max<size_t>(count, 1);
+            workers.reset();
+        }
+
+        size_t get_worker_count() const { return config.worker_count; }
+
+        // the heap grows by this percentage of its live bytes between full collections.
+        // defaults to LUAXC_GC_PERCENT, or 100.
+        void set_gc_percent(size_t percent) {
+            config.gc_percent = percent;
+            pace_after_full();
+        }
+
+        size_t get_gc_percent() const { return config.gc_percent; }
+
+        // objects allocated from now on are attributed to the call stack that allocated them
+        void start_profiling(HeapProfiler::StackSampler sampler) {
+            profiler = std::make_unique<HeapProfiler>(std::move(sampler));
+        }
+
+        // null unless profiling
+        const HeapProfiler* get_profiler() const { return profiler.get(); }
+
+        // pause histograms and the record of every collection so far
+        const GCTelemetry& get_telemetry() const { return telemetry; }
+
         size_t get_max_heap_size() const { return config.max_heap_size; }
 
         void increase_guard_semaphore() { ++guard_semaphore; }
@@ -96,7 +407,7 @@ namespace luaxc {
             --guard_semaphore;
 
             if (guard_semaphore == 0 && should_run_gc()) {
-                collect();
+                collect_by_policy();
             }
         }
 
@@ -107,44 +418,207 @@ namespace luaxc {
             size_t object_count = 0;
 
             bool running = false;
+
+            // in microseconds
+            size_t last_pause = 0;
+            size_t max_pause = 0;
+
+            size_t heap_goal = 0;
+            size_t nursery_size = 0;
+
+            size_t minor_collections = 0;
+            size_t full_collections = 0;
+
+            // in microseconds
+            size_t total_pause = 0;
+            size_t p99_pause = 0;
+
+            // of the last collection
+            double survival_ratio = 0.0;
+            // in bytes per second
+            double allocation_rate = 0.0;
         };
 
         DumpedStats dump_stats() const {
             return {statistics.bytes_allocated,
                     config.max_heap_size,
-                    gc_objects.size(),
-                    enabled};
+                    get_object_count(),
+                    enabled,
+                    statistics.last_pause,
+                    statistics.max_pause,
+                    statistics.heap_goal,
+                    statistics.nursery_size,
+                    statistics.minor_collections,
+                    statistics.full_collections,
+                    telemetry.get_total_pause(),
+                    telemetry.get_pauses().get_percentile(99),
+                    telemetry.get_last_collection().survival_ratio,
+                    telemetry.get_last_collection().allocation_rate};
         }
 
     private:
-        std::unordered_set<GCObject*> gc_objects;
+        using Clock = std::chrono::steady_clock;
+
+        GCHeap heap;
+
+        std::unique_ptr<GCWorkerPool> workers;
+
+        std::unique_ptr<HeapProfiler> profiler;
+
+        GCTelemetry telemetry;
+
+        // filled in while a collection runs, recorded with its last pause
+        GCCollectionStats collection;
+        bool collection_finished = false;
+
+        // objects created outside of the heap, either too large for a cell or registered after new.
+        // they belong to the old generation, and are only reclaimed by full collections.
+        std::vector<GCObject*> foreign_objects;
+
+        // objects registered with regist_no_collect, mapped to whether they are traced as roots.
+        // marking stops at immortal objects outside of the heap, so strings and native functions are never
+        // visited. the ones holding references, like modules and types, are traced as roots instead.
+        std::unordered_map<GCObject*, bool> immortal_objects;
+        std::vector<GCObject*> immortal_roots;
+
+        // registered since the last collection, they may have been filled with young objects
+        size_t young_foreign_begin = 0;
+        size_t young_immortal_root_begin = 0;
+
+        // remembered set, cleared by every collection since survivors are promoted
+        std::vector<GCObject*> remembered_objects;
+        std::vector<SharedStackFrameRef> remembered_frames;
+
+        // an incremental full collection is in progress.
+        // objects are shaded gray when marked, and blackened once their children are marked too.
+        bool marking = false;
+        std::vector<GCObject*> gray_objects;
+
         std::vector<PrimValue>* op_stack = nullptr;
-        std::list<StackFrame>* stack_frame = nullptr;
+        std::vector<StackFrame>* stack_frame = nullptr;
+        std::vector<FrozenContextObject*>* context_stack = nullptr;
 
         bool enabled = false;
         size_t guard_semaphore = 0;
 
         struct {
             size_t alloc_count = 0;
-            size_t last_object_count = 0;
             size_t bytes_allocated = 0;
+
+            size_t bytes_after_collection = 0;
+            size_t live_bytes_after_full = 0;
+
+            // set by the pacer after every collection
+            size_t heap_goal = 0;
+            size_t nursery_size = 0;
+
+            size_t last_pause = 0;
+            size_t max_pause = 0;
+
+            size_t minor_collections = 0;
+            size_t full_collections = 0;
+
+            // never decreases, for the allocation rate
+            size_t total_allocated = 0;
+            size_t allocated_at_last_collection = 0;
+            Clock::time_point last_collection_end = Clock::now();
+
+            size_t mortal_objects_after_collection = 0;
         } statistics;
 
         struct {
-            size_t allocation_threshold = 64;
-            double growth_factor = 2.0;
-            size_t memory_threshold = 1024 * 1024 * 1;// 1 MB
+            // the heap may grow by this percentage of the live bytes found by a full collection
+            // before the next one starts, like GOGC
+            size_t gc_percent = gc_percent_from_environment();
+            size_t min_heap_goal = 1024 * 1024 * 4;// 4 MB
+
+            // a minor collection runs once about this much garbage is expected in the young generation,
+            // the nursery is sized from the share of young bytes that survived the last one
+            size_t nursery_garbage = 1024 * 1024 * 1;// 1 MB
+            size_t min_nursery_size = 1024 * 256;    // 256 KB
+            size_t max_nursery_size = 1024 * 1024 * 16;// 16 MB
+
+            size_t pause_budget = 0;
+            // allocations between two slices of an incremental cycle
+            size_t slice_interval = 256;
+
+            size_t worker_count = std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1), 8);
+            // pages in the heap before a pause is shared with the workers
+            size_t parallel_page_threshold = 64;
 
             size_t max_heap_size = 1024 * 1024 * 64;// 64 MB
         } config;
 
+        size_t get_mortal_object_count() const { return heap.get_object_count() + foreign_objects.size(); }
+
+        size_t get_object_count() const { return get_mortal_object_count() + immortal_objects.size(); }
+
+        static size_t gc_percent_from_environment();
+
+        // sizes the nursery and the heap goal from what the last collection kept
+        void pace_after_minor(size_t young_bytes);
+
+        void pace_after_full();
+
         bool should_run_gc();
 
+        void collect_by_policy();
+
+        void begin_marking();
+
+        void mark_slice();
+
+        void finish_full_collection();
+
+        // measures the allocation rate since the previous collection
+        void begin_collection(bool full);
+
+        // `objects` and `bytes` were subject to the collection, what the sweep left of them was marked
+        void finish_collection(size_t objects, size_t bytes, const GCHeap::SweepResult& swept);
+
+        void record_pause(Clock::time_point started);
+
+        // objects created during an incremental cycle survive it
+        void allocate_black(GCObject* object) { try_mark(object); }
+
+        // for immortal objects given a reference after they were registered
+        void trace_as_immortal_root(GCObject* object);
+
+        // every survivor of a collection is old, nothing needs to be remembered past it
+        void forget_remembered_set();
+
+        // the cell or block of the object and everything it owns
+        static size_t measure(const GCObject* object);
+
+        // measures a marked object again, returns by how much it grew
+        static ptrdiff_t remeasure(GCObject* object);
+
+        void account_growth(ptrdiff_t growth);
+
+        static bool try_mark(GCObject* object);
+
+        static bool try_mark_atomically(GCObject* object);
+
+        // null while the heap is too small to be worth splitting
+        GCWorkerPool* parallel_workers();
+
         void mark_from_roots();
 
         void mark_object(GCObject* object);
 
-        void sweep();
+        struct GrayVisitor;
+
+        void mark_children(GCObject* object);
+
+        void drain_gray_objects();
+
+        void drain_gray_objects_in_parallel(GCWorkerPool& pool);
+
+        void mark_frame(const StackFrame& frame);
+
+        GCHeap::SweepResult sweep_heap();
+
+        GCHeap::SweepResult sweep();
     };
 
 }// namespace luaxc
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "gc_telemetry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace luaxc {
+    size_t GCHistogram::bucket_of(uint64_t value) {
+        if (value < sub_bucket_count * 2) {
+            return value;
+        }
+
+        unsigned magnitude = 0;
+        for (auto rest = value; rest > 1; rest >>= 1) {
+            magnitude++;
+        }
+
+        // the top sub_bucket_bits + 1 bits of the value pick the bucket
+        auto shift = magnitude - sub_bucket_bits;
+        auto top = value >> shift;
+        return sub_bucket_count * 2 + (shift - 1) * sub_bucket_count + (top - sub_bucket_count);
+    }
+
+    uint64_t GCHistogram::highest_value_in(size_t bucket) {
+        if (bucket < sub_bucket_count * 2) {
+            return bucket;
+        }
+
+        auto shift = (bucket - sub_bucket_count * 2) / sub_bucket_count + 1;
+        auto top = sub_bucket_count + (bucket - sub_bucket_count * 2) % sub_bucket_count;
+        // wraps around to UINT64_MAX for the last bucket
+        return ((top + 1) << shift) - 1;
+    }
+
+    void GCHistogram::record(uint64_t value) {
+        auto bucket = bucket_of(value);
+        if (bucket >= counts.size()) {
+            counts.resize(bucket + 1);
+        }
+
+        counts[bucket]++;
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    uint64_t GCHistogram::get_percentile(double percentile) const {
+        if (count == 0) {
+            return 0;
+        }
+
+        auto rank = static_cast<uint64_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * double(count)));
+        rank = std::max<uint64_t>(rank, 1);
+
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+            seen += counts[bucket];
+            if (seen >= rank) {
+                return std::clamp(highest_value_in(bucket), get_min(), max);
+            }
+        }
+        return max;
+    }
+
+    void GCTelemetry::record_pause(size_t pause) {
+        pauses.record(pause);
+        total_pause += pause;
+    }
+
+    void GCTelemetry::record_collection(const GCCollectionStats& collection) {
+        last_collection = collection;
+
+        (collection.full ? full_pauses : minor_pauses).record(collection.pause);
+        survival.record(static_cast<uint64_t>(std::lround(collection.survival_ratio * 100.0)));
+        allocation_rate.record(static_cast<uint64_t>(collection.allocation_rate));
+
+        total_freed_objects += collection.freed_objects;
+        total_freed_bytes += collection.freed_bytes;
+    }
+
+    namespace {
+        void write_distribution(std::ostream& out, const char* name, const GCHistogram& histogram, double scale = 1.0) {
+            out << "  " << std::left << std::setw(22) << name << std::right;
+            if (histogram.get_count() == 0) {
+                out << "-\n";
+                return;
+            }
+
+            // whole units unless scaled down
+            out << std::setprecision(scale == 1.0 ? 0 : 2)
+                << "p50 " << std::setw(9) << histogram.get_percentile(50) / scale
+                << "  p90 " << std::setw(9) << histogram.get_percentile(90) / scale
+                << "  p99 " << std::setw(9) << histogram.get_percentile(99) / scale
+                << "  max " << std::setw(9) << histogram.get_max() / scale << "\n";
+        }
+    }// namespace
+
+    void GCTelemetry::write_summary(std::ostream& out) const {
+        auto flags = out.flags();
+        auto precision = out.precision();
+        out << std::fixed << std::setprecision(2);
+
+        out << "GC Stats:\n"
+            << "  collections           " << minor_pauses.get_count() << " minor, " << full_pauses.get_count() << " full\n"
+            << "  pauses                " << pauses.get_count() << ", " << total_pause / 1000.0 << " ms in total\n"
+            << "  freed                 " << total_freed_objects << " objects, "
+            << total_freed_bytes / (1024.0 * 1024.0) << " MB\n";
+
+        write_distribution(out, "pause (us)", pauses);
+        write_distribution(out, "minor collection (us)", minor_pauses);
+        write_distribution(out, "full collection (us)", full_pauses);
+        write_distribution(out, "survival (%)", survival);
+        write_distribution(out, "allocation (MB/s)", allocation_rate, 1024.0 * 1024.0);
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+}// namespace luaxc
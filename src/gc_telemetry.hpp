@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+
+namespace luaxc {
+    // a histogram with log-linear buckets, like HdrHistogram.
+    // values below 64 are counted exactly, above that every power of two is split into 32 buckets,
+    // so recorded values are reported within about 3% of themselves in constant memory.
+    class GCHistogram {
+    public:
+        void record(uint64_t value);
+
+        uint64_t get_count() const { return count; }
+
+        uint64_t get_min() const { return count > 0 ? min : 0; }
+
+        uint64_t get_max() const { return max; }
+
+        double get_mean() const { return count > 0 ? double(sum) / double(count) : 0.0; }
+
+        // the value at or below which `percentile` percent of the recorded values fall, 0 when empty
+        uint64_t get_percentile(double percentile) const;
+
+    private:
+        static constexpr unsigned sub_bucket_bits = 5;
+        static constexpr uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_bits;
+
+        static size_t bucket_of(uint64_t value);
+
+        static uint64_t highest_value_in(size_t bucket);
+
+        // grown up to the largest bucket used
+        std::vector<uint64_t> counts;
+
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t min = UINT64_MAX;
+        uint64_t max = 0;
+    };
+
+    // what a single collection did
+    struct GCCollectionStats {
+        bool full = false;
+
+        // in microseconds, an incremental collection adds up all of its slices
+        size_t pause = 0;
+
+        // objects that survived, for minor collections only the young ones
+        size_t marked_objects = 0;
+        size_t marked_bytes = 0;
+
+        size_t freed_objects = 0;
+        size_t freed_bytes = 0;
+
+        // share of the collected bytes that was marked
+        double survival_ratio = 0.0;
+
+        // bytes per second allocated between the end of the previous collection and the start of this one
+        double allocation_rate = 0.0;
+    };
+
+    // running record of the collector's pauses and collections
+    class GCTelemetry {
+    public:
+        // every time the mutator was stopped, slices of an incremental collection included
+        void record_pause(size_t pause);
+
+        void record_collection(const GCCollectionStats& collection);
+
+        const GCCollectionStats& get_last_collection() const { return last_collection; }
+
+        // in microseconds
+        const GCHistogram& get_pauses() const { return pauses; }
+
+        const GCHistogram& get_minor_pauses() const { return minor_pauses; }
+
+        const GCHistogram& get_full_pauses() const { return full_pauses; }
+
+        // in percent
+        const GCHistogram& get_survival() const { return survival; }
+
+        // in bytes per second
+        const GCHistogram& get_allocation_rate() const { return allocation_rate; }
+
+        size_t get_total_pause() const { return total_pause; }
+
+        size_t get_total_freed_objects() const { return total_freed_objects; }
+
+        size_t get_total_freed_bytes() const { return total_freed_bytes; }
+
+        void write_summary(std::ostream& out) const;
+
+    private:
+        GCCollectionStats last_collection;
+
+        GCHistogram pauses;
+        GCHistogram minor_pauses;
+        GCHistogram full_pauses;
+        GCHistogram survival;
+        GCHistogram allocation_rate;
+
+        size_t total_pause = 0;
+        size_t total_freed_objects = 0;
+        size_t total_freed_bytes = 0;
+    };
+}// namespace luaxc
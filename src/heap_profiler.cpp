@@ -0,0 +1,55 @@
+#include "heap_profiler.hpp"
+
+namespace luaxc {
+    void HeapProfiler::record_allocation(const GCObject* object) {
+        live_objects[object] = intern_site();
+    }
+
+    void HeapProfiler::record_free(const GCObject* object) {
+        live_objects.erase(object);
+    }
+
+    size_t HeapProfiler::intern_site() {
+        sampled.functions.clear();
+        sampled.pc = 0;
+        sampler(sampled);
+
+        std::vector<size_t> key;
+        key.reserve(sampled.functions.size() * 2 + 1);
+        for (auto* function: sampled.functions) {
+            key.push_back(function->get_module_id());
+            key.push_back(function->get_begin_offset());
+        }
+        key.push_back(sampled.pc);
+
+        auto [it, inserted] = site_ids.emplace(std::move(key), sites.size());
+        if (!inserted) {
+            return it->second;
+        }
+
+        // named while the functions are still alive, they may be collected before the report
+        std::string frames = "<main>";
+        for (auto* function: sampled.functions) {
+            frames += ';';
+            frames += function->get_name() ? function->get_name()->to_string() : "<closure>";
+        }
+        frames += ";@" + std::to_string(sampled.pc);
+
+        sites.push_back(std::move(frames));
+        return it->second;
+    }
+
+    void HeapProfiler::write_folded(std::ostream& out) const {
+        // sorted, so that reports of the same program can be diffed
+        std::map<std::string, size_t> live_bytes;
+        for (auto& [object, site]: live_objects) {
+            // types are attached after allocation, so they are only looked up here
+            const TypeObject* type = object->type_info ? object->type_info : object->storage.prototype;
+            live_bytes[sites[site] + ";" + (type ? type->get_type_name() : "Object")] += object->accounted_size;
+        }
+
+        for (auto& [stack, bytes]: live_bytes) {
+            out << stack << " " << bytes << "\n";
+        }
+    }
+}// namespace luaxc
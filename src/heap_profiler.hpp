@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "value.hpp"
+
+
+namespace luaxc {
+    // attributes the live heap to the code that allocated it.
+    // every object allocated while profiling is tied to an allocation site: the script functions on the
+    // call stack and the bytecode pc of the allocating instruction. the collector reports freed objects,
+    // so the sites only ever account for live ones.
+    class HeapProfiler {
+    public:
+        struct CallStack {
+            // outermost call first, block scopes are not part of it
+            std::vector<const FunctionObject*> functions;
+            size_t pc = 0;
+        };
+
+        using StackSampler = std::function<void(CallStack&)>;
+
+        explicit HeapProfiler(StackSampler sampler) : sampler(std::move(sampler)) {}
+
+        void record_allocation(const GCObject* object);
+
+        void record_free(const GCObject* object);
+
+        // one line per allocation site and type, in the folded format read by flamegraph.pl and speedscope:
+        // `<main>;outer;inner;@pc;Type live_bytes`
+        void write_folded(std::ostream& out) const;
+
+        size_t get_live_object_count() const { return live_objects.size(); }
+
+    private:
+        size_t intern_site();
+
+        StackSampler sampler;
+        CallStack sampled;
+
+        // functions are identified by module and body, closures made from the same body share a site
+        std::map<std::vector<size_t>, size_t> site_ids;
+        // the folded frames of each site
+        std::vector<std::string> sites;
+
+        std::unordered_map<const GCObject*, size_t> live_objects;
+    };
+}// namespace luaxc
@@ -9,6 +9,8 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <sstream>
 
 
@@ -16,13 +18,14 @@ namespace luaxc {
 #define __LUAXC_IR_RUNTIME_UTILS_EXTRACT_STRING_FROM_PRIM_VALUE(_prim_value) \
     (static_cast<StringObject*>(static_cast<GCObject*>(_prim_value.get_inner_value<GCObject*>()))->contained_string())
 
-    std::string IRInstruction::dump() const {
+    std::string dump_instruction(const IRInstruction& instruction, const IRConstantTables& tables) {
         std::string out;
+        auto operand = instruction.operand;
 
-        switch (type) {
+        switch (instruction.type) {
             case IRInstruction::InstructionType::LOAD_CONST: {
                 out = "LOAD_CONST";
-                auto& p = std::get<IRLoadConstParam>(param);
+                auto& p = tables.get_constant(operand);
                 if (p.is_string()) {
                     out += " [string object \"" + __LUAXC_IR_RUNTIME_UTILS_EXTRACT_STRING_FROM_PRIM_VALUE(p) + "\"]";
                 } else {
@@ -32,20 +35,35 @@ namespace luaxc {
             }
             case IRInstruction::InstructionType::DECLARE_IDENTIFIER: {
                 out = "DECLARE_IDENTIFIER ";
-                out += std::get<IRDeclareIdentifierParam>(param).identifier->to_string();
+                out += tables.get_identifier(operand)->to_string();
                 break;
             }
             case IRInstruction::InstructionType::LOAD_IDENTIFIER:
                 out = "LOAD_IDENTIFIER ";
-                out += std::get<IRLoadIdentifierParam>(param).identifier->to_string();
+                out += tables.get_identifier(operand)->to_string();
                 break;
             case IRInstruction::InstructionType::STORE_IDENTIFIER:
                 out = "STORE_IDENTIFIER ";
-                out += std::get<IRStoreIdentifierParam>(param).identifier->to_string();
+                out += tables.get_identifier(operand)->to_string();
+                break;
+            case IRInstruction::InstructionType::DECLARE_LOCAL:
+                out = "DECLARE_LOCAL " + std::to_string(operand);
+                break;
+            case IRInstruction::InstructionType::LOAD_LOCAL:
+                out = "LOAD_LOCAL " + std::to_string(operand);
+                break;
+            case IRInstruction::InstructionType::STORE_LOCAL:
+                out = "STORE_LOCAL " + std::to_string(operand);
+                break;
+            case IRInstruction::InstructionType::LOAD_UPVALUE:
+                out = "LOAD_UPVALUE " + std::to_string(operand);
+                break;
+            case IRInstruction::InstructionType::STORE_UPVALUE:
+                out = "STORE_UPVALUE " + std::to_string(operand);
                 break;
             case IRInstruction::InstructionType::LOAD_MODULE:
                 out = "LOAD_MODULE ";
-                out += "[module id=" + std::to_string(std::get<IRLoadModuleParam>(param).module_id) + "]";
+                out += "[module id=" + std::to_string(operand) + "]";
                 break;
             case IRInstruction::InstructionType::ADD:
                 out = "ADD";
@@ -112,26 +130,30 @@ namespace luaxc {
                 break;
             case IRInstruction::InstructionType::JMP:
                 out = "JMP ";
-                out += std::to_string(std::get<IRJumpParam>(param));
+                out += std::to_string(operand);
                 break;
             case IRInstruction::InstructionType::JMP_IF_FALSE:
                 out = "JMP_IF_FALSE ";
-                out += std::to_string(std::get<IRJumpParam>(param));
+                out += std::to_string(operand);
                 break;
             case IRInstruction::InstructionType::JMP_REL:
                 out = "JMP_REL ";
-                out += std::to_string(std::get<IRJumpRelParam>(param));
+                out += std::to_string(instruction.get_jump_offset());
                 break;
             case IRInstruction::InstructionType::JMP_IF_FALSE_REL:
                 out = "JMP_IF_FALSE_REL ";
-                out += std::to_string(std::get<IRJumpRelParam>(param));
+                out += std::to_string(instruction.get_jump_offset());
+                break;
+            case IRInstruction::InstructionType::JMP_IF_TRUE_REL:
+                out = "JMP_IF_TRUE_REL ";
+                out += std::to_string(instruction.get_jump_offset());
                 break;
             case IRInstruction::InstructionType::TO_BOOL:
                 out = "TO_BOOL";
                 break;
             case IRInstruction::InstructionType::CALL:
                 out = "CALL ";
-                out += std::to_string(std::get<IRCallParam>(param).arguments_count);
+                out += std::to_string(operand);
                 break;
             case IRInstruction::InstructionType::RET:
                 out += "RET";
@@ -145,9 +167,6 @@ namespace luaxc {
             case IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED:
                 out += "BEGIN_LOCAL_DERIVED";
                 break;
-            case IRInstruction::InstructionType::MAKE_STRING:
-                out += "MAKE_STRING";
-                break;
             case IRInstruction::InstructionType::MAKE_FUNC:
                 out += "MAKE_FUNC";
                 break;
@@ -165,11 +184,11 @@ namespace luaxc {
                 break;
             case IRInstruction::InstructionType::LOAD_MEMBER:
                 out += "LOAD_MEMBER ";
-                out += std::get<IRLoadMemberParam>(param).identifier->to_string();
+                out += tables.get_member_site(operand).identifier->to_string();
                 break;
             case IRInstruction::InstructionType::STORE_MEMBER:
                 out += "STORE_MEMBER ";
-                out += std::get<IRStoreMemberParam>(param).identifier->to_string();
+                out += tables.get_member_site(operand).identifier->to_string();
                 break;
             case IRInstruction::InstructionType::LOAD_INDEXOF:
                 out += "LOAD_INDEXOF";
@@ -177,6 +196,78 @@ namespace luaxc {
             case IRInstruction::InstructionType::STORE_INDEXOF:
                 out += "STORE_INDEXOF";
                 break;
+            case IRInstruction::InstructionType::ADD_INT_INT:
+                out += "ADD_INT_INT";
+                break;
+            case IRInstruction::InstructionType::ADD_FLOAT_FLOAT:
+                out += "ADD_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::SUB_INT_INT:
+                out += "SUB_INT_INT";
+                break;
+            case IRInstruction::InstructionType::SUB_FLOAT_FLOAT:
+                out += "SUB_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::MUL_INT_INT:
+                out += "MUL_INT_INT";
+                break;
+            case IRInstruction::InstructionType::MUL_FLOAT_FLOAT:
+                out += "MUL_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::MOD_INT_INT:
+                out += "MOD_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_EQ_INT_INT:
+                out += "CMP_EQ_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_NE_INT_INT:
+                out += "CMP_NE_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_LT_INT_INT:
+                out += "CMP_LT_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_LT_FLOAT_FLOAT:
+                out += "CMP_LT_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::CMP_GT_INT_INT:
+                out += "CMP_GT_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_GT_FLOAT_FLOAT:
+                out += "CMP_GT_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::CMP_LE_INT_INT:
+                out += "CMP_LE_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_LE_FLOAT_FLOAT:
+                out += "CMP_LE_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::CMP_GE_INT_INT:
+                out += "CMP_GE_INT_INT";
+                break;
+            case IRInstruction::InstructionType::CMP_GE_FLOAT_FLOAT:
+                out += "CMP_GE_FLOAT_FLOAT";
+                break;
+            case IRInstruction::InstructionType::CMP_EQ_JMP_IF_FALSE:
+                out += "CMP_EQ_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::CMP_NE_JMP_IF_FALSE:
+                out += "CMP_NE_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::CMP_LT_JMP_IF_FALSE:
+                out += "CMP_LT_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::CMP_GT_JMP_IF_FALSE:
+                out += "CMP_GT_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::CMP_LE_JMP_IF_FALSE:
+                out += "CMP_LE_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::CMP_GE_JMP_IF_FALSE:
+                out += "CMP_GE_JMP_IF_FALSE";
+                break;
+            case IRInstruction::InstructionType::HALT:
+                out += "HALT";
+                break;
             default:
                 out = "UNKNOWN";
                 break;
@@ -184,16 +275,65 @@ namespace luaxc {
         return out;
     }
 
-    std::string dump_bytecode(const ByteCode& bytecode) {
+    std::string dump_bytecode(const ByteCode& bytecode, const IRConstantTables& tables) {
         std::stringstream out;
         size_t line = 0;
         for (const auto& instruction: bytecode) {
-            out << line << ": " << instruction.dump() << std::endl;
+            out << line << ": " << dump_instruction(instruction, tables) << std::endl;
             line++;
         }
         return out.str();
     }
 
+    template<typename T>
+    uint32_t IRConstantTables::next_index(const std::vector<T>& table) {
+        if (table.size() >= std::numeric_limits<uint32_t>::max()) {
+            throw IRGeneratorException("Too many entries in an operand table");
+        }
+        return static_cast<uint32_t>(table.size());
+    }
+
+    uint32_t IRConstantTables::add_constant(const PrimValue& value) {
+        auto index = next_index(constants);
+        constants.push_back(value);
+        return index;
+    }
+
+    uint32_t IRConstantTables::add_identifier(StringObject* identifier) {
+        // identifiers come from the string pool, pointers are unique per name
+        if (auto it = identifier_indices.find(identifier); it != identifier_indices.end()) {
+            return it->second;
+        }
+
+        auto index = next_index(identifiers);
+        identifiers.push_back(identifier);
+        identifier_indices.emplace(identifier, index);
+        return index;
+    }
+
+    uint32_t IRConstantTables::add_member_site(StringObject* identifier) {
+        // one site per instruction, each keeps its own inline cache
+        auto index = next_index(member_sites);
+        member_sites.push_back(IRMemberSite{identifier, {}});
+        return index;
+    }
+
+    uint32_t IRConstantTables::add_field_list(std::vector<StringObject*> fields) {
+        auto index = next_index(field_lists);
+        field_lists.push_back(std::move(fields));
+        return index;
+    }
+
+    uint32_t IRConstantTables::add_function(const IRMakeFunctionParam& function) {
+        auto index = next_index(functions);
+        functions.push_back(function);
+        return index;
+    }
+
+    IRConstantTables& IRGenerator::constant_tables() {
+        return runtime.get_constant_tables();
+    }
+
     ByteCode IRGenerator::generate() {
         ByteCode byte_code;
 
@@ -215,8 +355,21 @@ namespace luaxc {
         if (is_string_in_pool(str)) {
             string_obj = get_string_from_pool(str);
         } else {
-            string_obj = static_cast<StringObject*>(StringObject::from_string(str));
-            init_type_info(string_obj, "String");
+            // symbols are interned for the whole process, the builtin types and their shapes are shared
+            // between runtimes and compare their keys by address. they are never freed.
+            static std::mutex symbols_mutex;
+            static std::unordered_map<std::string, StringObject*> symbols;
+
+            {
+                std::lock_guard lock(symbols_mutex);
+                auto& symbol = symbols[str];
+                if (!symbol) {
+                    symbol = static_cast<StringObject*>(StringObject::from_string(str));
+                    symbol->make_symbol();
+                    init_type_info(symbol, "String");
+                }
+                string_obj = symbol;
+            }
 
             gc_regist_no_collect(string_obj);
             push_string_to_pool(str, string_obj);
@@ -282,9 +435,7 @@ namespace luaxc {
             case ExpressionNode::ExpressionType::Identifier: {
                 auto* cached_string =
                         runtime.push_string_pool_if_not_exists(static_cast<const IdentifierNode*>(node)->get_name());
-                byte_code.push_back(
-                        IRInstruction(IRInstruction::InstructionType::LOAD_IDENTIFIER,
-                                      {IRLoadIdentifierParam{cached_string}}));
+                generate_identifier_load(cached_string, byte_code);
                 break;
             }
             case ExpressionNode::ExpressionType::MemberAccessExpr: {
@@ -365,8 +516,7 @@ namespace luaxc {
 
         if (node->is_result_discarded()) {
             // discard the value
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::POP_STACK, {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::POP_STACK));
         }
     }
 
@@ -374,8 +524,8 @@ namespace luaxc {
         auto* decl_block = static_cast<BlockNode*>(expression->get_type_statements_block().get());
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED));
+        begin_derived_scope();
 
         // recursively assign all
         for (auto& s: decl_block->get_statements()) {
@@ -392,13 +542,9 @@ namespace luaxc {
 
                 auto* cached_string = runtime.push_string_pool_if_not_exists(field_name);
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                        IRDeclareIdentifierParam{cached_string}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::DECLARE_IDENTIFIER, constant_tables().add_identifier(cached_string)));
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::STORE_IDENTIFIER,
-                        IRStoreIdentifierParam{cached_string}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_IDENTIFIER, constant_tables().add_identifier(cached_string)));
 
             } else if (stmt->get_statement_type() == StatementNode::StatementType::MethodDeclarationStmt) {
                 generate_method_declaration_statement(static_cast<const MethodDeclarationNode*>(stmt), byte_code);
@@ -410,31 +556,29 @@ namespace luaxc {
         }
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::MAKE_TYPE,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::MAKE_TYPE));
 
+        end_derived_scope();
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::END_LOCAL,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::END_LOCAL));
     }
 
     void IRGenerator::generate_module_decl_expression(const ModuleDeclarationExpressionNode* expression, ByteCode& byte_code) {
         auto* decl_block = static_cast<const BlockNode*>(expression->get_module_statements_block().get());
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED));
+        begin_derived_scope();
 
         for (auto& statement: decl_block->get_statements()) {
             generate_statement(static_cast<const StatementNode*>(statement.get()), byte_code);
         }
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::MAKE_MODULE_LOCAL,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::MAKE_MODULE_LOCAL));
+        end_derived_scope();
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::END_LOCAL,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::END_LOCAL));
     }
 
     void IRGenerator::generate_module_import_expression(const ModuleImportExpresionNode* expression, ByteCode& byte_code) {
@@ -444,8 +588,7 @@ namespace luaxc {
         // if the module is already loaded,
         // we can just use it
         if (auto loaded_module = is_module_present(module_name_str)) {
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MODULE,
-                                              IRLoadModuleParam{loaded_module.value()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MODULE, loaded_module.value()));
             return;
         }
 
@@ -459,22 +602,21 @@ namespace luaxc {
         ByteCode module_byte_code;
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED));
 
         auto* module_name = begin_module_compilation(module_name_str, byte_code.size());
+        begin_derived_scope();
         generate_program_or_block(module_ast.get(), module_byte_code);
+        end_derived_scope();
         size_t module_id = end_module_compilation();
 
         byte_code.reserve(module_byte_code.size());
         byte_code.insert(byte_code.end(), module_byte_code.begin(), module_byte_code.end());
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::MAKE_MODULE,
-                              IRMakeModuleParam{module_id}));
+                IRInstruction(IRInstruction::InstructionType::MAKE_MODULE, module_id));
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::END_LOCAL,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::END_LOCAL));
     }
 
     void IRGenerator::generate_module_access_expression(const ExpressionNode* expression, ByteCode& byte_code) {
@@ -492,9 +634,7 @@ namespace luaxc {
 
                     generate_module_access_expression(static_cast<const ExpressionNode*>(left), byte_code);
 
-                    byte_code.push_back(IRInstruction(
-                            IRInstruction::InstructionType::LOAD_MEMBER,
-                            IRLoadMemberParam{str_obj}));
+                    byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MEMBER, constant_tables().add_member_site(str_obj)));
 
                     break;
                 }
@@ -513,12 +653,9 @@ namespace luaxc {
 
                     generate_module_access_expression(static_cast<const ExpressionNode*>(left), byte_code);
 
-                    byte_code.push_back(IRInstruction(
-                            IRInstruction::InstructionType::LOAD_MEMBER,
-                            IRLoadMemberParam{str_obj}));
+                    byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MEMBER, constant_tables().add_member_site(str_obj)));
 
-                    byte_code.push_back(IRInstruction(
-                            IRInstruction::InstructionType::CALL, IRCallParam{arguments_count}));
+                    byte_code.push_back(IRInstruction(IRInstruction::InstructionType::CALL, arguments_count));
                     break;
                 }
                 default: {
@@ -534,52 +671,43 @@ namespace luaxc {
 
     void IRGenerator::generate_closure_expression(const ClosureExpressionNode* expression, ByteCode& byte_code) {
         size_t jump_over_function_instruction_index = byte_code.size();
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL,
-                IRJumpRelParam(0)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
 
         size_t fn_start_index = byte_code.size();
 
-        for (auto& param: expression->get_parameters()) {
-            auto identifier =
-                    runtime.push_string_pool_if_not_exists(dynamic_cast<IdentifierNode*>(param.get())->get_name());
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                    IRDeclareIdentifierParam{identifier}));
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_IDENTIFIER,
-                    IRStoreIdentifierParam{identifier}));
-        }
+        begin_function_scope(expression->get_parameters(), expression->get_body().get(), true);
+        generate_parameters(expression->get_parameters(), byte_code);
 
         generate_program_or_block(expression->get_body().get(), byte_code);
 
         if (byte_code.back().type != IRInstruction::InstructionType::RET) {
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::LOAD_CONST, IRLoadConstParam{IRPrimValue::unit()}));
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET, {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(IRPrimValue::unit())));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET));
         }
 
-        byte_code[jump_over_function_instruction_index].param =
-                IRJumpRelParam(byte_code.size() - jump_over_function_instruction_index);
+        auto upvalues = std::move(local_scopes.back().upvalues);
+        auto locals = end_function_scope();
+
+        byte_code[jump_over_function_instruction_index].set_jump_offset(byte_code.size() - jump_over_function_instruction_index);
 
         auto current_module_id = get_current_compiling_module_id();
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::MAKE_FUNC,
-                IRMakeFunctionParam{
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::MAKE_FUNC, constant_tables().add_function(IRMakeFunctionParam{
                         fn_start_index,
                         current_module_id,
                         expression->get_parameters().size(),
                         false,
-                        true}));
+                        true,
+                        locals,
+                        std::move(upvalues)})));
     }
 
     void IRGenerator::generate_rule_expression(const RuleExpressionNode* expression, ByteCode& byte_code) {
         auto* rule_block = static_cast<BlockNode*>(expression->get_rule_block().get());
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED));
+        begin_derived_scope();
 
         for (auto& s: rule_block->get_statements()) {
             auto stmt = static_cast<StatementNode*>(s.get());
@@ -591,33 +719,27 @@ namespace luaxc {
 
                 auto* cached_string = runtime.push_string_pool_if_not_exists(constraint_name);
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                        IRDeclareIdentifierParam{cached_string}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::DECLARE_IDENTIFIER, constant_tables().add_identifier(cached_string)));
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::STORE_IDENTIFIER,
-                        IRStoreIdentifierParam{cached_string}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_IDENTIFIER, constant_tables().add_identifier(cached_string)));
             } else {
                 throw IRGeneratorException("Only constraint declaration is supported in rule body");
             }
         }
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::MAKE_RULE,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::MAKE_RULE));
+        end_derived_scope();
 
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::END_LOCAL,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::END_LOCAL));
     }
 
     void IRGenerator::generate_numeric_literal(const NumericLiteralNode* statement, ByteCode& byte_code) {
         auto type = statement->get_type();
-        auto value = IRLoadConstParam(statement->get_value());
+        auto value = IRPrimValue(statement->get_value());
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::LOAD_CONST,
-                              {value}));
+                IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(value)));
     }
 
     void IRGenerator::generate_string_literal(const StringLiteralNode* statement, ByteCode& byte_code) {
@@ -625,14 +747,9 @@ namespace luaxc {
 
         auto value = IRPrimValue(ValueType::String, string_obj);
 
+        // literals are the immutable strings of the pool, evaluating one allocates nothing
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::LOAD_CONST,
-                              {IRLoadConstParam(value)}));
-
-        // we need to copy the string from constant pool!
-        byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::MAKE_STRING,
-                              {std::monostate()}));
+                IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(value)));
     }
 
     void IRGenerator::generate_declaration_statement(const DeclarationStmtNode* node, ByteCode& byte_code) {
@@ -648,9 +765,7 @@ namespace luaxc {
 
                 auto* cached_string = runtime.push_string_pool_if_not_exists(identifier_node->get_name());
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                        IRDeclareIdentifierParam{cached_string}));
+                generate_identifier_declaration(cached_string, byte_code);
             }
             return;
         }
@@ -660,12 +775,8 @@ namespace luaxc {
         auto* identifier_node = static_cast<IdentifierNode*>(identifiers[0].get());
         auto* cached_string = runtime.push_string_pool_if_not_exists(identifier_node->get_name());
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                IRDeclareIdentifierParam{cached_string}));
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::STORE_IDENTIFIER,
-                IRStoreIdentifierParam{cached_string}));
+        generate_identifier_declaration(cached_string, byte_code);
+        generate_identifier_store(cached_string, byte_code);
     }
 
     void IRGenerator::generate_assignment_statement(const AssignmentExpressionNode* node, ByteCode& byte_code) {
@@ -692,9 +803,7 @@ namespace luaxc {
         generate_expression(static_cast<const ExpressionNode*>(expr), byte_code);
 
         auto* cached_string = runtime.push_string_pool_if_not_exists(identifier->get_name());
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::STORE_IDENTIFIER,
-                IRStoreIdentifierParam{cached_string}));
+        generate_identifier_store(cached_string, byte_code);
     }
 
     void IRGenerator::generate_initializer_list_expression(const InitializerListExpressionNode* expression, ByteCode& byte_code) {
@@ -729,7 +838,7 @@ namespace luaxc {
             // anonymous initializer list
             auto* any_type = TypeObject::any();
             auto type_value = PrimValue(ValueType::Type, (GCObject*){any_type});
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, IRLoadConstParam(type_value)));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(type_value)));
         } else {
             // push the type info onto the stack
             generate_expression(type_expr, byte_code);
@@ -737,7 +846,7 @@ namespace luaxc {
 
         // load the field names in reverse order, as we will acquire the values in reverse order
         auto fields_rev = std::vector<StringObject*>(fields.rbegin(), fields.rend());
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::MAKE_OBJECT, IRMakeObjectParam{fields_rev}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::MAKE_OBJECT, constant_tables().add_field_list(fields_rev)));
     }
 
     void IRGenerator::generate_member_access(const ExpressionNode* expression, ByteCode& byte_code) {
@@ -760,15 +869,11 @@ namespace luaxc {
 
                 generate_expression(prefixed_expr, byte_code);
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::PEEK, {std::monostate()}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::PEEK));
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::LOAD_MEMBER,
-                        IRLoadMemberParam{cached_identifier}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MEMBER, constant_tables().add_member_site(cached_identifier)));
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::CALL, IRCallParam{real_arguments_count}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::CALL, real_arguments_count));
                 break;
             }
             case (ExpressionNode::ExpressionType::MemberAccessExpr): {
@@ -780,18 +885,14 @@ namespace luaxc {
                     auto* identifier = static_cast<const IdentifierNode*>(expr->get_member_identifier().get());
                     auto* str_obj = runtime.push_string_pool_if_not_exists(identifier->get_name());
 
-                    byte_code.push_back(IRInstruction(
-                            IRInstruction::InstructionType::LOAD_MEMBER,
-                            IRLoadMemberParam{str_obj}));
+                    byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_MEMBER, constant_tables().add_member_site(str_obj)));
                 } else {
                     auto* index =
                             static_cast<const ExpressionNode*>(expr->get_member_identifier().get());
 
                     generate_expression(index, byte_code);
 
-                    byte_code.push_back(IRInstruction(
-                            IRInstruction::InstructionType::LOAD_INDEXOF,
-                            {std::monostate()}));
+                    byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_INDEXOF));
                 }
                 break;
             }
@@ -825,27 +926,222 @@ namespace luaxc {
                             member_access->get_member_identifier().get())
                             ->get_name());
 
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_MEMBER,
-                    IRStoreMemberParam{identifier}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_MEMBER, constant_tables().add_member_site(identifier)));
         } else {
             auto* index =
                     static_cast<const ExpressionNode*>(member_access->get_member_identifier().get());
 
             generate_expression(index, byte_code);
 
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_INDEXOF,
-                    {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_INDEXOF));
         }
     }
 
     void IRGenerator::generate_implicit_receiver(ByteCode& byte_code) {
         auto* implicit_receiver = runtime.push_string_pool_if_not_exists("self");
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::LOAD_IDENTIFIER,
-                IRLoadIdentifierParam{implicit_receiver}));
+        generate_identifier_load(implicit_receiver, byte_code);
+    }
+
+    size_t IRGenerator::LocalScope::declare(StringObject* identifier) {
+        if (auto it = slots.find(identifier); it != slots.end()) {
+            return it->second;
+        }
+
+        size_t slot = names.size();
+        slots.emplace(identifier, slot);
+        names.push_back(identifier);
+        return slot;
+    }
+
+    std::optional<size_t> IRGenerator::LocalScope::resolve(StringObject* identifier) const {
+        if (auto it = slots.find(identifier); it != slots.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    size_t IRGenerator::LocalScope::capture(const IRUpvalueDesc& upvalue) {
+        for (size_t i = 0; i < upvalues.size(); i++) {
+            if (upvalues[i].name == upvalue.name) {
+                return i;
+            }
+        }
+
+        upvalues.push_back(upvalue);
+        return upvalues.size() - 1;
+    }
+
+    void IRGenerator::begin_function_scope(const std::vector<std::unique_ptr<AstNode>>& parameters, const AstNode* body, bool captures) {
+        LocalScope scope;
+        scope.resolvable = true;
+        scope.captures = captures;
+
+        // arguments are pushed in reverse order and become the bottom of the callee's slot window,
+        // so the last parameter takes the first slot.
+        for (auto param = parameters.rbegin(); param != parameters.rend(); ++param) {
+            scope.declare(runtime.push_string_pool_if_not_exists(static_cast<IdentifierNode*>(param->get())->get_name()));
+        }
+
+        // hoist every binding of the function body into a slot up front,
+        // so that uses placed before the declaration still resolve to the same slot.
+        // slots start out undeclared, so the runtime behaviour is the same as name lookups.
+        collect_local_declarations(static_cast<const StatementNode*>(body), scope);
+
+        local_scopes.push_back(std::move(scope));
+    }
+
+    LocalSlotNames IRGenerator::end_function_scope() {
+        auto names = std::make_shared<const std::vector<StringObject*>>(std::move(local_scopes.back().names));
+        local_scopes.pop_back();
+        return names;
+    }
+
+    void IRGenerator::begin_derived_scope() {
+        local_scopes.push_back(LocalScope{});
+    }
+
+    void IRGenerator::end_derived_scope() {
+        local_scopes.pop_back();
+    }
+
+    void IRGenerator::collect_local_declarations(const StatementNode* statement, LocalScope& scope) {
+        if (statement == nullptr) {
+            return;
+        }
+
+        switch (statement->get_statement_type()) {
+            case StatementNode::StatementType::DeclarationStmt: {
+                for (auto& identifier: static_cast<const DeclarationStmtNode*>(statement)->get_identifiers()) {
+                    auto& name = static_cast<IdentifierNode*>(identifier.get())->get_name();
+                    scope.declare(runtime.push_string_pool_if_not_exists(name));
+                }
+                break;
+            }
+            case StatementNode::StatementType::FunctionDeclarationStmt: {
+                auto* fn = static_cast<const FunctionDeclarationNode*>(statement);
+                if (fn->get_function_body() != nullptr) {
+                    auto& name = static_cast<IdentifierNode*>(fn->get_identifier().get())->get_name();
+                    scope.declare(runtime.push_string_pool_if_not_exists(name));
+                }
+                break;
+            }
+            case StatementNode::StatementType::BlockStmt: {
+                for (auto& s: static_cast<const BlockNode*>(statement)->get_statements()) {
+                    collect_local_declarations(static_cast<const StatementNode*>(s.get()), scope);
+                }
+                break;
+            }
+            case StatementNode::StatementType::IfStmt: {
+                auto* if_stmt = static_cast<const IfNode*>(statement);
+                collect_local_declarations(static_cast<const StatementNode*>(if_stmt->get_body().get()), scope);
+                collect_local_declarations(static_cast<const StatementNode*>(if_stmt->get_else_body().get()), scope);
+                break;
+            }
+            case StatementNode::StatementType::WhileStmt: {
+                auto* while_stmt = static_cast<const WhileNode*>(statement);
+                collect_local_declarations(static_cast<const StatementNode*>(while_stmt->get_body().get()), scope);
+                break;
+            }
+            case StatementNode::StatementType::ForStmt: {
+                auto* for_stmt = static_cast<const ForNode*>(statement);
+                collect_local_declarations(static_cast<const StatementNode*>(for_stmt->get_init_stmt().get()), scope);
+                collect_local_declarations(static_cast<const StatementNode*>(for_stmt->get_body().get()), scope);
+                break;
+            }
+            default:
+                // expressions never declare anything in the enclosing function.
+                break;
+        }
+    }
+
+    std::optional<size_t> IRGenerator::resolve_local(StringObject* identifier) const {
+        if (local_scopes.empty() || !local_scopes.back().resolvable) {
+            return std::nullopt;
+        }
+        return local_scopes.back().resolve(identifier);
+    }
+
+    std::optional<size_t> IRGenerator::resolve_upvalue(StringObject* identifier) {
+        if (local_scopes.empty() || !local_scopes.back().resolvable) {
+            return std::nullopt;
+        }
+        return resolve_upvalue_in_scope(local_scopes.size() - 1, identifier);
+    }
+
+    std::optional<size_t> IRGenerator::resolve_upvalue_in_scope(size_t scope_index, StringObject* identifier) {
+        auto& scope = local_scopes[scope_index];
+        if (!scope.captures || scope_index == 0) {
+            return std::nullopt;
+        }
+
+        // only look through functions, derived scopes keep their variables by name
+        auto& enclosing = local_scopes[scope_index - 1];
+        if (!enclosing.resolvable) {
+            return std::nullopt;
+        }
+
+        if (auto slot = enclosing.resolve(identifier)) {
+            return scope.capture(IRUpvalueDesc{identifier, true, slot.value()});
+        }
+
+        if (auto upvalue = resolve_upvalue_in_scope(scope_index - 1, identifier)) {
+            return scope.capture(IRUpvalueDesc{identifier, false, upvalue.value()});
+        }
+
+        return std::nullopt;
+    }
+
+    void IRGenerator::generate_identifier_declaration(StringObject* identifier, ByteCode& byte_code) {
+        if (auto slot = resolve_local(identifier)) {
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::DECLARE_LOCAL, slot.value()));
+            return;
+        }
+
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::DECLARE_IDENTIFIER, constant_tables().add_identifier(identifier)));
+    }
+
+    void IRGenerator::generate_identifier_load(StringObject* identifier, ByteCode& byte_code) {
+        if (auto slot = resolve_local(identifier)) {
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_LOCAL, slot.value()));
+            return;
+        }
+
+        if (auto upvalue = resolve_upvalue(identifier)) {
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_UPVALUE, upvalue.value()));
+            return;
+        }
+
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_IDENTIFIER, constant_tables().add_identifier(identifier)));
+    }
+
+    void IRGenerator::generate_identifier_store(StringObject* identifier, ByteCode& byte_code) {
+        if (auto slot = resolve_local(identifier)) {
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_LOCAL, slot.value()));
+            return;
+        }
+
+        if (auto upvalue = resolve_upvalue(identifier)) {
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_UPVALUE, upvalue.value()));
+            return;
+        }
+
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_IDENTIFIER, constant_tables().add_identifier(identifier)));
+    }
+
+    void IRGenerator::generate_parameters(const std::vector<std::unique_ptr<AstNode>>& parameters, ByteCode& byte_code) {
+        for (auto& param: parameters) {
+            auto identifier =
+                    runtime.push_string_pool_if_not_exists(dynamic_cast<IdentifierNode*>(param.get())->get_name());
+
+            // slot-resolved parameters already sit in the callee's window
+            if (resolve_local(identifier)) {
+                continue;
+            }
+
+            generate_identifier_declaration(identifier, byte_code);
+            generate_identifier_store(identifier, byte_code);
+        }
     }
 
     std::optional<size_t> IRGenerator::is_module_present(const std::string& module_name) {
@@ -903,19 +1199,16 @@ namespace luaxc {
             return;
         }
 
+        if (is_binary_logical_operator(node_op)) {
+            generate_short_circuit_expression(statement, byte_code);
+            return;
+        }
+
         const auto& left = statement->get_left();
         const auto& right = statement->get_right();
 
         generate_expression(static_cast<const ExpressionNode*>(left.get()), byte_code);
-        if (is_binary_logical_operator(node_op)) {
-            // when the logical operator is used, we need to convert the lhs and rhs value to boolean
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
-        }
-
         generate_expression(static_cast<const ExpressionNode*>(right.get()), byte_code);
-        if (is_binary_logical_operator(node_op)) {
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
-        }
 
         IRInstruction::InstructionType op_type;
 
@@ -980,9 +1273,91 @@ namespace luaxc {
                 throw IRGeneratorException("Unsupported binary operator");
         }
 
-        byte_code.push_back(IRInstruction(
-                op_type,
-                {std::monostate()}));
+        byte_code.push_back(IRInstruction(op_type));
+    }
+
+    void IRGenerator::generate_short_circuit_expression(const BinaryExpressionNode* statement, ByteCode& byte_code) {
+        // the lhs decides on its own when it is false for '&&' or true for '||',
+        // and is then left as the result. otherwise the rhs is the result.
+        auto jump_type = statement->get_op() == BinaryExpressionNode::BinaryOperator::LogicalAnd
+                                 ? IRInstruction::InstructionType::JMP_IF_FALSE_REL
+                                 : IRInstruction::InstructionType::JMP_IF_TRUE_REL;
+
+        generate_expression(static_cast<const ExpressionNode*>(statement->get_left().get()), byte_code);
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::PEEK));
+
+        size_t short_circuit_index = byte_code.size();
+        byte_code.push_back(IRInstruction::relative_jump(jump_type, 0));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::POP_STACK));
+
+        generate_expression(static_cast<const ExpressionNode*>(statement->get_right().get()), byte_code);
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL));
+
+        byte_code[short_circuit_index].set_jump_offset(byte_code.size() - short_circuit_index);
+    }
+
+    static std::optional<IRInstruction::InstructionType> select_fused_compare_branch(IRInstruction::InstructionType op) {
+        using InstructionType = IRInstruction::InstructionType;
+
+        switch (op) {
+            case InstructionType::CMP_EQ:
+                return InstructionType::CMP_EQ_JMP_IF_FALSE;
+            case InstructionType::CMP_NE:
+                return InstructionType::CMP_NE_JMP_IF_FALSE;
+            case InstructionType::CMP_LT:
+                return InstructionType::CMP_LT_JMP_IF_FALSE;
+            case InstructionType::CMP_GT:
+                return InstructionType::CMP_GT_JMP_IF_FALSE;
+            case InstructionType::CMP_LE:
+                return InstructionType::CMP_LE_JMP_IF_FALSE;
+            case InstructionType::CMP_GE:
+                return InstructionType::CMP_GE_JMP_IF_FALSE;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    std::vector<size_t> IRGenerator::generate_condition(const ExpressionNode* expression, ByteCode& byte_code) {
+        if (expression->get_expression_type() == ExpressionNode::ExpressionType::BinaryExpr) {
+            auto* binary = static_cast<const BinaryExpressionNode*>(expression);
+            auto* left = static_cast<const ExpressionNode*>(binary->get_left().get());
+            auto* right = static_cast<const ExpressionNode*>(binary->get_right().get());
+
+            if (binary->get_op() == BinaryExpressionNode::BinaryOperator::LogicalAnd) {
+                auto false_jumps = generate_condition(left, byte_code);
+                auto right_false_jumps = generate_condition(right, byte_code);
+                false_jumps.insert(false_jumps.end(), right_false_jumps.begin(), right_false_jumps.end());
+                return false_jumps;
+            }
+
+            if (binary->get_op() == BinaryExpressionNode::BinaryOperator::LogicalOr) {
+                generate_expression(left, byte_code);
+
+                size_t taken_index = byte_code.size();
+                byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_IF_TRUE_REL, 0));
+
+                auto false_jumps = generate_condition(right, byte_code);
+                byte_code[taken_index].set_jump_offset(byte_code.size() - taken_index);
+                return false_jumps;
+            }
+        }
+
+        generate_expression(expression, byte_code);
+
+        // compare and branch in one go, the jump below still carries the offset
+        if (auto fused = select_fused_compare_branch(byte_code.back().type)) {
+            byte_code.back().type = fused.value();
+        }
+
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_IF_FALSE_REL, 0));
+        return {byte_code.size() - 1};
+    }
+
+    void IRGenerator::patch_jumps(ByteCode& byte_code, const std::vector<size_t>& jumps, size_t target) {
+        for (auto jump: jumps) {
+            byte_code[jump].set_jump_offset(target - jump);
+        }
     }
 
     void IRGenerator::generate_combinative_assignment_statement(const BinaryExpressionNode* statement, ByteCode& byte_code) {
@@ -1013,15 +1388,11 @@ namespace luaxc {
 
             // load the identifier and push onto the stack
             auto* cached_string = runtime.push_string_pool_if_not_exists(left_identifier);
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::LOAD_IDENTIFIER,
-                    IRLoadIdentifierParam{cached_string}));
+            generate_identifier_load(cached_string, byte_code);
 
-            byte_code.push_back(IRInstruction(instruction_type, {std::monostate()}));
+            byte_code.push_back(IRInstruction(instruction_type));
 
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_IDENTIFIER,
-                    IRStoreIdentifierParam{cached_string}));
+            generate_identifier_store(cached_string, byte_code);
         } else if (left_expr->get_expression_type() == ExpressionNode::ExpressionType::MemberAccessExpr) {
             auto* member_access = static_cast<const MemberAccessExpressionNode*>(left_expr);
             auto* member_access_left = static_cast<const ExpressionNode*>(member_access->get_object_expr().get());
@@ -1032,7 +1403,7 @@ namespace luaxc {
             // then push value
             generate_member_access(left_expr, byte_code);
             generate_expression(static_cast<const ExpressionNode*>(right.get()), byte_code);
-            byte_code.push_back(IRInstruction(instruction_type, {std::monostate()}));
+            byte_code.push_back(IRInstruction(instruction_type));
 
             if (member_access->get_access_type() == MemberAccessExpressionNode::MemberAccessType::DotMemberAccess) {
                 auto* identifier = runtime.push_string_pool_if_not_exists(
@@ -1040,18 +1411,14 @@ namespace luaxc {
                                 member_access->get_member_identifier().get())
                                 ->get_name());
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::STORE_MEMBER,
-                        IRStoreMemberParam{identifier}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_MEMBER, constant_tables().add_member_site(identifier)));
             } else {
                 auto* index =
                         static_cast<const ExpressionNode*>(member_access->get_member_identifier().get());
 
                 generate_expression(index, byte_code);
 
-                byte_code.push_back(IRInstruction(
-                        IRInstruction::InstructionType::STORE_INDEXOF,
-                        {std::monostate()}));
+                byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_INDEXOF));
             }
         } else {
             throw IRGeneratorException("Invalid conbinative assignment");
@@ -1063,7 +1430,7 @@ namespace luaxc {
 
         generate_expression(static_cast<const ExpressionNode*>(operand.get()), byte_code);
         if (statement->get_operator() == UnaryExpressionNode::UnaryOperator::BitwiseNot) {
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL));
         }
 
         IRInstruction::InstructionType op_type;
@@ -1082,32 +1449,25 @@ namespace luaxc {
             default:
                 throw IRGeneratorException("Unsupported unary operator");
         }
-        byte_code.push_back(IRInstruction(op_type, {std::monostate()}));
+        byte_code.push_back(IRInstruction(op_type));
     }
 
     void IRGenerator::generate_boolean_literal(const BoolLiteralNode* statement, ByteCode& byte_code) {
         byte_code.push_back(
-                IRInstruction(IRInstruction::InstructionType::LOAD_CONST,
-                              IRLoadConstParam{PrimValue::from_bool(statement->get_value())}));
+                IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(PrimValue::from_bool(statement->get_value()))));
     }
 
     void IRGenerator::generate_null_literal(ByteCode& byte_code) {
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::LOAD_CONST,
-                IRLoadConstParam{PrimValue::null()}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(PrimValue::null())));
     }
 
     void IRGenerator::generate_if_statement(const IfNode* statement, ByteCode& byte_code) {
         auto* expr = statement->get_condition().get();
 
-        generate_expression(static_cast<const ExpressionNode*>(expr), byte_code);
-
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::JMP_IF_FALSE_REL, {std::monostate()}));
+        auto false_jumps = generate_condition(static_cast<const ExpressionNode*>(expr), byte_code);
 
         bool has_else_clause = statement->get_else_body().get() != nullptr;
 
-        size_t zero_index = byte_code.size() - 1;// j*
         size_t if_end_index = 0;
         size_t else_clause_index = 0;
 
@@ -1117,29 +1477,24 @@ namespace luaxc {
         if (has_else_clause) {
             // in this case the 'end of if clause' is the jump to the end of the if statement
             // as we don't want it to jump directly to the end, so we add the offset by 1
-            byte_code[zero_index].param = IRJumpRelParam(if_end_index + 1 - zero_index);
+            patch_jumps(byte_code, false_jumps, if_end_index + 1);
 
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::JMP_REL, IRJumpRelParam(0)));
+            byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
             generate_statement(static_cast<StatementNode*>(statement->get_else_body().get()), byte_code);
             else_clause_index = byte_code.size();
-            byte_code[if_end_index].param = IRJumpRelParam(else_clause_index - if_end_index);
+            byte_code[if_end_index].set_jump_offset(else_clause_index - if_end_index);
         } else {
-            byte_code[zero_index].param = IRJumpRelParam(if_end_index - zero_index);
+            patch_jumps(byte_code, false_jumps, if_end_index);
         }
     }
 
     void IRGenerator::generate_while_statement(const WhileNode* statement, ByteCode& byte_code) {
         auto* expr = statement->get_condition().get();
 
-        size_t while_start_index, while_end_index, while_start_jmp_index;
+        size_t while_start_index, while_end_index;
         while_start_index = byte_code.size();
 
-        generate_expression(static_cast<const ExpressionNode*>(expr), byte_code);
-
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::JMP_IF_FALSE_REL, {std::monostate()}));
-
-        while_start_jmp_index = byte_code.size() - 1;
+        auto false_jumps = generate_condition(static_cast<const ExpressionNode*>(expr), byte_code);
 
         while_loop_generation_stack.push(WhileLoopGenerationContext{});
 
@@ -1149,26 +1504,24 @@ namespace luaxc {
 
         ssize_t current_jmp_index = byte_code.size() - 1;
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL,
-                IRJumpRelParam(while_start_index - current_jmp_index - 1)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, while_start_index - current_jmp_index - 1));
 
         // the first command after the loop
         while_end_index = byte_code.size();
 
         // fill in jump target for unmet condition
-        byte_code[while_start_jmp_index].param = IRJumpRelParam(while_end_index - while_start_jmp_index);
+        patch_jumps(byte_code, false_jumps, while_end_index);
 
         auto generation_ctx = while_loop_generation_stack.top();
         while_loop_generation_stack.pop();
         // fill in jump targets of breaks
         for (auto break_instruction: generation_ctx.break_instructions) {
-            byte_code[break_instruction].param = IRJumpRelParam(while_end_index - break_instruction);
+            byte_code[break_instruction].set_jump_offset(while_end_index - break_instruction);
         }
 
         // fill in jump targets of continues
         for (auto continue_instruction: generation_ctx.continue_instructions) {
-            byte_code[continue_instruction].param = IRJumpRelParam(while_start_index - continue_instruction);
+            byte_code[continue_instruction].set_jump_offset(while_start_index - continue_instruction);
         }
     }
 
@@ -1179,12 +1532,7 @@ namespace luaxc {
         size_t condition_start_index = byte_code.size();// the command after decl / assignment
 
         auto* cond_expr = statement->get_condition_expr().get();
-        generate_expression(static_cast<const ExpressionNode*>(cond_expr), byte_code);
-
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::TO_BOOL, {std::monostate()}));
-        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::JMP_IF_FALSE_REL, {std::monostate()}));
-
-        size_t jump_to_end_of_loop = byte_code.size() - 1;// jmp_if_false
+        auto jumps_to_end_of_loop = generate_condition(static_cast<const ExpressionNode*>(cond_expr), byte_code);
 
         while_loop_generation_stack.push(WhileLoopGenerationContext{});
 
@@ -1197,23 +1545,22 @@ namespace luaxc {
 
         ssize_t current_jmp_index = byte_code.size() - 1;
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL, IRJumpRelParam(condition_start_index - current_jmp_index - 1)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, condition_start_index - current_jmp_index - 1));
 
         size_t loop_end_index = byte_code.size();
 
-        byte_code[jump_to_end_of_loop].param = IRJumpRelParam(loop_end_index - jump_to_end_of_loop);
+        patch_jumps(byte_code, jumps_to_end_of_loop, loop_end_index);
 
         auto generation_context = while_loop_generation_stack.top();
         while_loop_generation_stack.pop();
 
         // similar to while loops
         for (auto break_instruction: generation_context.break_instructions) {
-            byte_code[break_instruction].param = IRJumpRelParam(loop_end_index - break_instruction);
+            byte_code[break_instruction].set_jump_offset(loop_end_index - break_instruction);
         }
 
         for (auto continue_instruction: generation_context.continue_instructions) {
-            byte_code[continue_instruction].param = IRJumpRelParam(condition_start_index - continue_instruction);
+            byte_code[continue_instruction].set_jump_offset(condition_start_index - continue_instruction);
         }
     }
 
@@ -1221,8 +1568,7 @@ namespace luaxc {
         assert(while_loop_generation_stack.size() > 0);
 
         auto& ctx = while_loop_generation_stack.top();
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL, IRJumpRelParam(0)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
         ctx.register_break_instruction(byte_code.size() - 1);
     }
 
@@ -1230,12 +1576,12 @@ namespace luaxc {
         assert(while_loop_generation_stack.size() > 0);
 
         auto& ctx = while_loop_generation_stack.top();
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL, IRJumpRelParam(0)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
         ctx.register_continue_instruction(byte_code.size() - 1);
     }
 
     IRInterpreter::IRInterpreter(IRRuntime& runtime) : runtime(runtime) {
+        reserve_stacks();
         push_stack_frame();// global scope
         preload_native_functions();
     }
@@ -1245,7 +1591,9 @@ namespace luaxc {
         if (stack_frames.size() != 1) {
             std::cerr << "Abnormal quit with corrupted stack!" << std::endl;
         }
-        pop_stack_frame();
+
+        // the runtime's collector is already gone, only hand the pending refs their copies
+        current_stack_frame().notify_return();
     }
 
     void IRGenerator::generate_function_invocation_statement(const FunctionInvocationExpressionNode* node, ByteCode& byte_code) {
@@ -1261,8 +1609,7 @@ namespace luaxc {
         // load the function object
         generate_expression(static_cast<const ExpressionNode*>(node->get_function_identifier().get()), byte_code);
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::CALL, IRCallParam{arguments_count}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::CALL, arguments_count));
     }
 
     void IRGenerator::generate_function_declaration_statement(
@@ -1275,56 +1622,38 @@ namespace luaxc {
         }
 
         size_t jump_over_function_instruction_index = byte_code.size();
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL,
-                IRJumpRelParam(0)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
 
         size_t fn_start_index = byte_code.size();
 
-        for (auto& param: statement->get_parameters()) {
-            auto identifier =
-                    runtime.push_string_pool_if_not_exists(dynamic_cast<IdentifierNode*>(param.get())->get_name());
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                    IRDeclareIdentifierParam{identifier}));
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_IDENTIFIER,
-                    IRStoreIdentifierParam{identifier}));
-        }
+        begin_function_scope(statement->get_parameters(), statement->get_function_body().get());
+        generate_parameters(statement->get_parameters(), byte_code);
 
         generate_program_or_block(statement->get_function_body().get(), byte_code);
 
         // no return value
         if (byte_code.back().type != IRInstruction::InstructionType::RET) {
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::LOAD_CONST, IRLoadConstParam{IRPrimValue::unit()}));
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET, {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(IRPrimValue::unit())));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET));
         }
 
-        byte_code[jump_over_function_instruction_index].param =
-                IRJumpRelParam(byte_code.size() - jump_over_function_instruction_index);
+        auto locals = end_function_scope();
+
+        byte_code[jump_over_function_instruction_index].set_jump_offset(byte_code.size() - jump_over_function_instruction_index);
 
         auto current_module_id = get_current_compiling_module_id();
         auto function_identifier =
                 static_cast<IdentifierNode*>(statement->get_identifier().get())->get_name();
+        auto* cached_function_identifier = runtime.push_string_pool_if_not_exists(function_identifier);
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::MAKE_FUNC,
-                IRMakeFunctionParam{
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::MAKE_FUNC, constant_tables().add_function(IRMakeFunctionParam{
                         fn_start_index,
                         current_module_id,
                         statement->get_parameters().size(),
-                        false, false}));
-
-        auto* cached_function_identifier = runtime.push_string_pool_if_not_exists(function_identifier);
+                        false, false, locals, {}, cached_function_identifier})));
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                IRDeclareIdentifierParam{cached_function_identifier}));
-
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::STORE_IDENTIFIER,
-                IRStoreIdentifierParam{cached_function_identifier}));
+        generate_identifier_declaration(cached_function_identifier, byte_code);
+        generate_identifier_store(cached_function_identifier, byte_code);
     }
 
     void IRGenerator::generate_method_declaration_statement(const MethodDeclarationNode* statement, ByteCode& byte_code) {
@@ -1334,251 +1663,471 @@ namespace luaxc {
         }
 
         size_t jump_over_function_instruction_index = byte_code.size();
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::JMP_REL,
-                IRJumpRelParam(0)));
+        byte_code.push_back(IRInstruction::relative_jump(IRInstruction::InstructionType::JMP_REL, 0));
 
         size_t fn_start_index = byte_code.size();
 
-        for (auto& param: statement->get_parameters()) {
-            auto identifier =
-                    runtime.push_string_pool_if_not_exists(dynamic_cast<IdentifierNode*>(param.get())->get_name());
-
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                    IRDeclareIdentifierParam{identifier}));
-
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::STORE_IDENTIFIER,
-                    IRStoreIdentifierParam{identifier}));
-        }
+        begin_function_scope(statement->get_parameters(), statement->get_function_body().get());
+        generate_parameters(statement->get_parameters(), byte_code);
 
         generate_program_or_block(statement->get_function_body().get(), byte_code);
 
         // no return value
         if (byte_code.back().type != IRInstruction::InstructionType::RET) {
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::LOAD_CONST, IRLoadConstParam{IRPrimValue::unit()}));
-            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET, {std::monostate()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(IRPrimValue::unit())));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET));
         }
 
-        byte_code[jump_over_function_instruction_index].param =
-                IRJumpRelParam(byte_code.size() - jump_over_function_instruction_index);
+        auto locals = end_function_scope();
+
+        byte_code[jump_over_function_instruction_index].set_jump_offset(byte_code.size() - jump_over_function_instruction_index);
 
         auto current_module_id = get_current_compiling_module_id();
         auto function_identifier =
                 static_cast<IdentifierNode*>(statement->get_identifier().get())->get_name();
+        auto* cached_function_identifier = runtime.push_string_pool_if_not_exists(function_identifier);
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::MAKE_FUNC,
-                IRMakeFunctionParam{
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::MAKE_FUNC, constant_tables().add_function(IRMakeFunctionParam{
                         fn_start_index,
                         current_module_id,
                         statement->get_parameters().size(),
-                        true, false}));
-
-        auto* cached_function_identifier = runtime.push_string_pool_if_not_exists(function_identifier);
+                        true, false, locals, {}, cached_function_identifier})));
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::DECLARE_IDENTIFIER,
-                IRDeclareIdentifierParam{cached_function_identifier}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::DECLARE_IDENTIFIER, constant_tables().add_identifier(cached_function_identifier)));
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::STORE_IDENTIFIER, IRStoreIdentifierParam{cached_function_identifier}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::STORE_IDENTIFIER, constant_tables().add_identifier(cached_function_identifier)));
     }
 
     void IRGenerator::generate_return_statement(const ReturnNode* statement, ByteCode& byte_code) {
         if (statement->get_expression().get() == nullptr) {
             // no return value
-            byte_code.push_back(IRInstruction(
-                    IRInstruction::InstructionType::LOAD_CONST, IRLoadConstParam{IRPrimValue::unit()}));
+            byte_code.push_back(IRInstruction(IRInstruction::InstructionType::LOAD_CONST, constant_tables().add_constant(IRPrimValue::unit())));
         } else {
             generate_expression(static_cast<ExpressionNode*>(statement->get_expression().get()), byte_code);
         }
 
-        byte_code.push_back(IRInstruction(
-                IRInstruction::InstructionType::RET, {std::monostate()}));
+        byte_code.push_back(IRInstruction(IRInstruction::InstructionType::RET));
     }
 
-    void IRInterpreter::run() {
-        size_t size = byte_code.size();
-        while (pc < size) {
-            bool jumped = false;
+#if defined(LUAXC_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define LUAXC_IR_THREADED_DISPATCH 1
+#else
+#define LUAXC_IR_THREADED_DISPATCH 0
+#endif
 
-            auto& instruction = byte_code[pc];
-            switch (instruction.type) {
-                case IRInstruction::InstructionType::LOAD_CONST:
-                    push_op_stack(std::get<IRLoadConstParam>(instruction.param));
-                    break;
-                case IRInstruction::InstructionType::DECLARE_IDENTIFIER: {
-                    declare_identifier(std::get<IRDeclareIdentifierParam>(instruction.param).identifier);
-                    break;
-                }
-                case IRInstruction::InstructionType::LOAD_IDENTIFIER: {
-                    auto param = std::get<IRLoadIdentifierParam>(instruction.param);
-                    push_op_stack(retrieve_raw_value(param.identifier));
-                    break;
+    // handler bodies are shared by both dispatch engines.
+    // threaded: every handler jumps straight to the next one through the label table.
+    // portable: a plain switch inside a loop.
+    // the byte code always ends with HALT, so neither of them checks bounds.
+#if LUAXC_IR_THREADED_DISPATCH
+#define __LUAXC_IR_OP(_op) op_##_op:
+#define __LUAXC_IR_DISPATCH()                                                  \
+    {                                                                          \
+        instruction = byte_code[pc];                                           \
+        goto* dispatch_table[static_cast<uint8_t>(instruction.type)];          \
+    }
+#else
+#define __LUAXC_IR_OP(_op) case IRInstruction::InstructionType::_op:
+#define __LUAXC_IR_DISPATCH() continue;
+#endif
+
+#define __LUAXC_IR_NEXT() \
+    {                     \
+        pc++;             \
+        __LUAXC_IR_DISPATCH() \
+    }
+
+#define __LUAXC_IR_NEXT_UNLESS_JUMPED(_jumped) \
+    {                                          \
+        if (!(_jumped)) pc++;                  \
+        __LUAXC_IR_DISPATCH()                  \
+    }
+
+#if LUAXC_IR_THREADED_DISPATCH
+    // every instruction type in the order they are declared in, one label each in the dispatch table
+#define __LUAXC_IR_INSTRUCTIONS(_X)     \
+    _X(LOAD_CONST)                      \
+    _X(DECLARE_IDENTIFIER)              \
+    _X(LOAD_IDENTIFIER)                 \
+    _X(STORE_IDENTIFIER)                \
+    _X(DECLARE_LOCAL)                   \
+    _X(LOAD_LOCAL)                      \
+    _X(STORE_LOCAL)                     \
+    _X(LOAD_UPVALUE)                    \
+    _X(STORE_UPVALUE)                   \
+    _X(LOAD_MODULE)                     \
+    _X(ADD)                             \
+    _X(SUB)                             \
+    _X(MUL)                             \
+    _X(DIV)                             \
+    _X(MOD)                             \
+    _X(NEGATE)                          \
+    _X(AND)                             \
+    _X(LOGICAL_AND)                     \
+    _X(OR)                              \
+    _X(LOGICAL_OR)                      \
+    _X(NOT)                             \
+    _X(LOGICAL_NOT)                     \
+    _X(XOR)                             \
+    _X(SHL)                             \
+    _X(SHR)                             \
+    _X(CMP_EQ)                          \
+    _X(CMP_NE)                          \
+    _X(CMP_LT)                          \
+    _X(CMP_GT)                          \
+    _X(CMP_LE)                          \
+    _X(CMP_GE)                          \
+    _X(TO_BOOL)                         \
+    _X(JMP)                             \
+    _X(JMP_IF_FALSE)                    \
+    _X(JMP_REL)                         \
+    _X(JMP_IF_FALSE_REL)                \
+    _X(JMP_IF_TRUE_REL)                 \
+    _X(POP_STACK)                       \
+    _X(PEEK)                            \
+    _X(MAKE_TYPE)                       \
+    _X(MAKE_OBJECT)                     \
+    _X(MAKE_FUNC)                       \
+    _X(MAKE_RULE)                       \
+    _X(MAKE_MODULE)                     \
+    _X(MAKE_MODULE_LOCAL)               \
+    _X(BEGIN_LOCAL)                     \
+    _X(END_LOCAL)                       \
+    _X(BEGIN_LOCAL_DERIVED)             \
+    _X(LOAD_MEMBER)                     \
+    _X(STORE_MEMBER)                    \
+    _X(LOAD_INDEXOF)                    \
+    _X(STORE_INDEXOF)                   \
+    _X(CALL)                            \
+    _X(RET)                             \
+    _X(ADD_INT_INT)                     \
+    _X(ADD_FLOAT_FLOAT)                 \
+    _X(SUB_INT_INT)                     \
+    _X(SUB_FLOAT_FLOAT)                 \
+    _X(MUL_INT_INT)                     \
+    _X(MUL_FLOAT_FLOAT)                 \
+    _X(MOD_INT_INT)                     \
+    _X(CMP_EQ_INT_INT)                  \
+    _X(CMP_NE_INT_INT)                  \
+    _X(CMP_LT_INT_INT)                  \
+    _X(CMP_LT_FLOAT_FLOAT)              \
+    _X(CMP_GT_INT_INT)                  \
+    _X(CMP_GT_FLOAT_FLOAT)              \
+    _X(CMP_LE_INT_INT)                  \
+    _X(CMP_LE_FLOAT_FLOAT)              \
+    _X(CMP_GE_INT_INT)                  \
+    _X(CMP_GE_FLOAT_FLOAT)              \
+    _X(CMP_EQ_JMP_IF_FALSE)             \
+    _X(CMP_NE_JMP_IF_FALSE)             \
+    _X(CMP_LT_JMP_IF_FALSE)             \
+    _X(CMP_GT_JMP_IF_FALSE)             \
+    _X(CMP_LE_JMP_IF_FALSE)             \
+    _X(CMP_GE_JMP_IF_FALSE)             \
+    _X(HALT)
+
+    namespace {
+#define __LUAXC_IR_TYPE(_op) IRInstruction::InstructionType::_op,
+        constexpr IRInstruction::InstructionType dispatch_order[] = {__LUAXC_IR_INSTRUCTIONS(__LUAXC_IR_TYPE)};
+#undef __LUAXC_IR_TYPE
+
+        constexpr bool is_in_declaration_order() {
+            for (size_t i = 0; i < std::size(dispatch_order); i++) {
+                if (static_cast<size_t>(dispatch_order[i]) != i) {
+                    return false;
                 }
-                case IRInstruction::InstructionType::STORE_IDENTIFIER: {
-                    auto param = std::get<IRStoreIdentifierParam>(instruction.param);
+            }
+            return std::size(dispatch_order) == static_cast<size_t>(IRInstruction::InstructionType::HALT) + 1;
+        }
+    }// namespace
+#endif
 
-                    auto value = pop_op_stack();
+    void IRInterpreter::run() {
+        auto& tables = runtime.get_constant_tables();
+        auto instruction = IRInstruction(IRInstruction::InstructionType::HALT);
+
+#if LUAXC_IR_THREADED_DISPATCH
+        // the table is constant, interpreters on any thread share it without setting anything up
+#define __LUAXC_IR_LABEL(_op) &&op_##_op,
+        static void* const dispatch_table[] = {__LUAXC_IR_INSTRUCTIONS(__LUAXC_IR_LABEL)};
+#undef __LUAXC_IR_LABEL
+        static_assert(is_in_declaration_order(), "the dispatch table lists instruction types out of order");
+
+        __LUAXC_IR_DISPATCH()
+#else
+        while (true) {
+            instruction = byte_code[pc];
+            switch (instruction.type) {
+#endif
+        __LUAXC_IR_OP(LOAD_CONST) {
+            push_op_stack(tables.get_constant(instruction.operand));
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(DECLARE_IDENTIFIER) {
+            declare_identifier(tables.get_identifier(instruction.operand));
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(LOAD_IDENTIFIER) {
+            push_op_stack(retrieve_raw_value(tables.get_identifier(instruction.operand)));
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(STORE_IDENTIFIER) {
+            auto value = pop_op_stack();
 
-                    store_raw_value(param.identifier, value);
-                    break;
-                }
+            store_raw_value(tables.get_identifier(instruction.operand), value);
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::LOAD_MODULE: {
-                    handle_module_load(std::get<IRLoadModuleParam>(instruction.param));
-                    break;
-                }
+        __LUAXC_IR_OP(DECLARE_LOCAL) {
+            handle_local_declaration(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(LOAD_LOCAL) {
+            handle_local_load(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(STORE_LOCAL) {
+            handle_local_store(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::POP_STACK: {
-                    if (auto& handler = runtime.handlers.pop_stack_handler) {
-                        handler(op_stack_top());
-                    }
+        __LUAXC_IR_OP(LOAD_UPVALUE) {
+            handle_upvalue_load(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
 
-                    pop_op_stack();
-                    break;
-                }
+        __LUAXC_IR_OP(STORE_UPVALUE) {
+            auto* upvalue = current_stack_frame().function->get_upvalue(instruction.operand);
+            throw IRInterpreterException("Cannot modify immutable captured variable " + upvalue->get_name()->to_string());
+        }
+
+        __LUAXC_IR_OP(LOAD_MODULE) {
+            handle_module_load(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
+
+        __LUAXC_IR_OP(POP_STACK) {
+            if (auto& handler = runtime.handlers.pop_stack_handler) {
+                handler(op_stack_top());
+            }
+
+            pop_op_stack();
+            __LUAXC_IR_NEXT()
+        }
+
+        __LUAXC_IR_OP(PEEK) {
+            peek_op_stack();
+            __LUAXC_IR_NEXT()
+        }
+
+        __LUAXC_IR_OP(TO_BOOL) {
+            handle_to_bool();
+            __LUAXC_IR_NEXT()
+        }
+
+        __LUAXC_IR_OP(ADD)
+        __LUAXC_IR_OP(SUB)
+        __LUAXC_IR_OP(MUL)
+        __LUAXC_IR_OP(DIV)
+        __LUAXC_IR_OP(MOD)
+
+        __LUAXC_IR_OP(AND)
+        __LUAXC_IR_OP(OR)
+        __LUAXC_IR_OP(XOR)
+        __LUAXC_IR_OP(SHL)
+        __LUAXC_IR_OP(SHR)
+
+        __LUAXC_IR_OP(LOGICAL_AND)
+        __LUAXC_IR_OP(LOGICAL_OR)
+
+        __LUAXC_IR_OP(CMP_EQ)
+        __LUAXC_IR_OP(CMP_NE)
+        __LUAXC_IR_OP(CMP_LT)
+        __LUAXC_IR_OP(CMP_LE)
+        __LUAXC_IR_OP(CMP_GT)
+        __LUAXC_IR_OP(CMP_GE) {
+            quicken_binary_op(byte_code[pc]);
 
-                case IRInstruction::InstructionType::PEEK: {
-                    peek_op_stack();
-                    break;
-                }
+            bool jumped = handle_binary_op(instruction.type);
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
 
-                case IRInstruction::InstructionType::TO_BOOL:
-                    handle_to_bool();
-                    break;
+#define __LUAXC_IR_QUICKENED_BINARY_OP(_op, _generic_op, _is_type, _type, _from, _expr) \
+    __LUAXC_IR_OP(_op) {                                                               \
+        auto& rhs = stack[stack.size() - 1];                                           \
+        auto& lhs = stack[stack.size() - 2];                                           \
+        if (lhs._is_type() && rhs._is_type()) {                                        \
+            auto l = lhs.get_inner_value<_type>();                                     \
+            auto r = rhs.get_inner_value<_type>();                                     \
+            stack.pop_back();                                                          \
+            stack.back() = PrimValue::_from(_expr);                                    \
+            __LUAXC_IR_NEXT()                                                          \
+        }                                                                              \
+                                                                                       \
+        bool jumped = deoptimize_binary_op(IRInstruction::InstructionType::_generic_op); \
+        __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)                                          \
+    }
 
-                case IRInstruction::InstructionType::ADD:
-                case IRInstruction::InstructionType::SUB:
-                case IRInstruction::InstructionType::MUL:
-                case IRInstruction::InstructionType::DIV:
-                case IRInstruction::InstructionType::MOD:
-
-                case IRInstruction::InstructionType::AND:
-                case IRInstruction::InstructionType::OR:
-                case IRInstruction::InstructionType::XOR:
-                case IRInstruction::InstructionType::SHL:
-                case IRInstruction::InstructionType::SHR:
-
-                case IRInstruction::InstructionType::LOGICAL_AND:
-                case IRInstruction::InstructionType::LOGICAL_OR:
-
-                case IRInstruction::InstructionType::CMP_EQ:
-                case IRInstruction::InstructionType::CMP_NE:
-                case IRInstruction::InstructionType::CMP_LT:
-                case IRInstruction::InstructionType::CMP_LE:
-                case IRInstruction::InstructionType::CMP_GT:
-                case IRInstruction::InstructionType::CMP_GE:
-                    jumped = handle_binary_op(instruction.type);
-                    break;
+        __LUAXC_IR_QUICKENED_BINARY_OP(ADD_INT_INT, ADD, is_int, Int, from_i64, l + r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(ADD_FLOAT_FLOAT, ADD, is_float, Float, from_f64, l + r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(SUB_INT_INT, SUB, is_int, Int, from_i64, l - r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(SUB_FLOAT_FLOAT, SUB, is_float, Float, from_f64, l - r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(MUL_INT_INT, MUL, is_int, Int, from_i64, l * r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(MUL_FLOAT_FLOAT, MUL, is_float, Float, from_f64, l * r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(MOD_INT_INT, MOD, is_int, Int, from_i64, l % r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_EQ_INT_INT, CMP_EQ, is_int, Int, from_bool, l == r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_NE_INT_INT, CMP_NE, is_int, Int, from_bool, l != r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_LT_INT_INT, CMP_LT, is_int, Int, from_bool, l < r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_LT_FLOAT_FLOAT, CMP_LT, is_float, Float, from_bool, l < r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_GT_INT_INT, CMP_GT, is_int, Int, from_bool, l > r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_GT_FLOAT_FLOAT, CMP_GT, is_float, Float, from_bool, l > r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_LE_INT_INT, CMP_LE, is_int, Int, from_bool, l <= r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_LE_FLOAT_FLOAT, CMP_LE, is_float, Float, from_bool, l <= r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_GE_INT_INT, CMP_GE, is_int, Int, from_bool, l >= r)
+        __LUAXC_IR_QUICKENED_BINARY_OP(CMP_GE_FLOAT_FLOAT, CMP_GE, is_float, Float, from_bool, l >= r)
 
-                case IRInstruction::InstructionType::NOT:
-                case IRInstruction::InstructionType::LOGICAL_NOT:
-                case IRInstruction::InstructionType::NEGATE:
-                    jumped = handle_unary_op(instruction.type);
-                    break;
+#undef __LUAXC_IR_QUICKENED_BINARY_OP
 
-                case IRInstruction::InstructionType::JMP:
-                case IRInstruction::InstructionType::JMP_IF_FALSE:
-                    jumped = handle_jump(instruction.type, std::get<IRJumpParam>(instruction.param));
-                    break;
+#define __LUAXC_IR_FUSED_COMPARE_BRANCH(_op, _generic_op, _cmp)                              \
+    __LUAXC_IR_OP(_op) {                                                                     \
+        auto& rhs = stack[stack.size() - 1];                                                 \
+        auto& lhs = stack[stack.size() - 2];                                                 \
+        bool holds;                                                                          \
+        if (lhs.is_int() && rhs.is_int()) {                                                  \
+            holds = lhs.get_inner_value<Int>() _cmp rhs.get_inner_value<Int>();              \
+        } else if (lhs.is_float() && rhs.is_float()) {                                       \
+            holds = lhs.get_inner_value<Float>() _cmp rhs.get_inner_value<Float>();          \
+        } else {                                                                             \
+            bool jumped = handle_binary_op(IRInstruction::InstructionType::_generic_op);     \
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)                                            \
+        }                                                                                    \
+                                                                                             \
+        stack.pop_back();                                                                    \
+        stack.pop_back();                                                                    \
+        /* skip over the jump, or take it */                                                 \
+        pc += holds ? 2 : 1 + byte_code[pc + 1].get_jump_offset();                           \
+        __LUAXC_IR_DISPATCH()                                                                \
+    }
 
-                case IRInstruction::InstructionType::JMP_REL:
-                case IRInstruction::InstructionType::JMP_IF_FALSE_REL:
-                    jumped = handle_relative_jump(instruction.type, std::get<IRJumpRelParam>(instruction.param));
-                    break;
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_EQ_JMP_IF_FALSE, CMP_EQ, ==)
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_NE_JMP_IF_FALSE, CMP_NE, !=)
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_LT_JMP_IF_FALSE, CMP_LT, <)
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_GT_JMP_IF_FALSE, CMP_GT, >)
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_LE_JMP_IF_FALSE, CMP_LE, <=)
+        __LUAXC_IR_FUSED_COMPARE_BRANCH(CMP_GE_JMP_IF_FALSE, CMP_GE, >=)
 
-                case IRInstruction::InstructionType::CALL: {
-                    auto param = std::get<IRCallParam>(instruction.param);
-                    jumped = handle_function_invocation(param);
-                    break;
-                }
+#undef __LUAXC_IR_FUSED_COMPARE_BRANCH
 
-                case IRInstruction::InstructionType::RET: {
-                    handle_return();
-                    jumped = true;
-                    break;
-                }
+        __LUAXC_IR_OP(NOT)
+        __LUAXC_IR_OP(LOGICAL_NOT)
+        __LUAXC_IR_OP(NEGATE) {
+            bool jumped = handle_unary_op(instruction.type);
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
 
-                case IRInstruction::InstructionType::MAKE_STRING: {
-                    handle_make_string();
-                    break;
-                }
+        __LUAXC_IR_OP(JMP)
+        __LUAXC_IR_OP(JMP_IF_FALSE) {
+            bool jumped = handle_jump(instruction.type, instruction.operand);
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
 
-                case IRInstruction::InstructionType::MAKE_FUNC: {
-                    handle_make_function(std::get<IRMakeFunctionParam>(instruction.param));
-                    break;
-                }
+        __LUAXC_IR_OP(JMP_REL)
+        __LUAXC_IR_OP(JMP_IF_FALSE_REL)
+        __LUAXC_IR_OP(JMP_IF_TRUE_REL) {
+            bool jumped = handle_relative_jump(instruction.type, instruction.get_jump_offset());
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
 
-                case IRInstruction::InstructionType::MAKE_TYPE: {
-                    handle_type_creation();
-                    break;
-                }
+        __LUAXC_IR_OP(CALL) {
+            bool jumped = handle_function_invocation(IRCallParam{instruction.operand});
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
 
-                case IRInstruction::InstructionType::MAKE_RULE: {
-                    handle_make_rule();
-                    break;
-                }
+        __LUAXC_IR_OP(RET) {
+            handle_return();
+            __LUAXC_IR_DISPATCH()
+        }
 
-                case IRInstruction::InstructionType::MAKE_OBJECT: {
-                    handle_make_object(std::get<IRMakeObjectParam>(instruction.param));
-                    break;
-                }
+        __LUAXC_IR_OP(MAKE_FUNC) {
+            handle_make_function(tables.get_function(instruction.operand));
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::MAKE_MODULE: {
-                    handle_make_module(std::get<IRMakeModuleParam>(instruction.param));
-                    break;
-                }
-                case IRInstruction::InstructionType::MAKE_MODULE_LOCAL: {
-                    handle_make_module_local();
-                    break;
-                }
+        __LUAXC_IR_OP(MAKE_TYPE) {
+            handle_type_creation();
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::BEGIN_LOCAL: {
-                    push_stack_frame(false);
-                    break;
-                }
-                case IRInstruction::InstructionType::END_LOCAL: {
-                    pop_stack_frame();
-                    break;
-                }
+        __LUAXC_IR_OP(MAKE_RULE) {
+            handle_make_rule();
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::BEGIN_LOCAL_DERIVED: {
-                    push_stack_frame(true);
-                    break;
-                }
+        __LUAXC_IR_OP(MAKE_OBJECT) {
+            handle_make_object(tables.get_field_list(instruction.operand));
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::LOAD_MEMBER: {
-                    jumped = handle_member_load(std::get<IRLoadMemberParam>(instruction.param));
-                    break;
-                }
-                case IRInstruction::InstructionType::STORE_MEMBER: {
-                    jumped = handle_member_store(std::get<IRStoreMemberParam>(instruction.param));
-                    break;
-                }
+        __LUAXC_IR_OP(MAKE_MODULE) {
+            handle_make_module(instruction.operand);
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(MAKE_MODULE_LOCAL) {
+            handle_make_module_local();
+            __LUAXC_IR_NEXT()
+        }
 
-                case IRInstruction::InstructionType::LOAD_INDEXOF: {
-                    jumped = handle_index_load();
-                    break;
-                }
-                case IRInstruction::InstructionType::STORE_INDEXOF: {
-                    jumped = handle_index_store();
-                    break;
-                }
+        __LUAXC_IR_OP(BEGIN_LOCAL) {
+            push_stack_frame(false);
+            __LUAXC_IR_NEXT()
+        }
+        __LUAXC_IR_OP(END_LOCAL) {
+            pop_stack_frame();
+            __LUAXC_IR_NEXT()
+        }
 
+        __LUAXC_IR_OP(BEGIN_LOCAL_DERIVED) {
+            push_stack_frame(true);
+            __LUAXC_IR_NEXT()
+        }
+
+        __LUAXC_IR_OP(LOAD_MEMBER) {
+            bool jumped = handle_member_load(tables.get_member_site(instruction.operand));
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
+        __LUAXC_IR_OP(STORE_MEMBER) {
+            bool jumped = handle_member_store(tables.get_member_site(instruction.operand));
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
+
+        __LUAXC_IR_OP(LOAD_INDEXOF) {
+            bool jumped = handle_index_load();
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
+        __LUAXC_IR_OP(STORE_INDEXOF) {
+            bool jumped = handle_index_store();
+            __LUAXC_IR_NEXT_UNLESS_JUMPED(jumped)
+        }
+
+        __LUAXC_IR_OP(HALT) {
+            return;
+        }
+
+#if !LUAXC_IR_THREADED_DISPATCH
                 default:
                     throw IRInterpreterException("Invalid instruction type");
             }
-
-            if (!jumped) {
-                pc++;
-            }
         }
+#endif
     }
 
+#if LUAXC_IR_THREADED_DISPATCH
+#undef __LUAXC_IR_INSTRUCTIONS
+#endif
+#undef __LUAXC_IR_OP
+#undef __LUAXC_IR_DISPATCH
+#undef __LUAXC_IR_NEXT
+#undef __LUAXC_IR_NEXT_UNLESS_JUMPED
+
     bool IRInterpreter::handle_jump(IRInstruction::InstructionType op, IRJumpParam param) {
         switch (op) {
             case IRInstruction::InstructionType::JMP:
@@ -1615,6 +2164,14 @@ namespace luaxc {
                 }
                 break;
             }
+            case IRInstruction::InstructionType::JMP_IF_TRUE_REL: {
+                auto cond = pop_op_stack().to_bool();
+                if (cond & 1) {
+                    pc += param;
+                    return true;
+                }
+                break;
+            }
             default:
                 throw IRInterpreterException("Unknown instruction type");
         }
@@ -1655,7 +2212,9 @@ namespace luaxc {
         // set the context of the functions
         auto* ctx = freeze_context();
         for (auto* fn: functions) {
+            runtime.get_gc().deletion_barrier(fn->get_context());
             fn->set_context(ctx);
+            runtime.get_gc().write_barrier(fn, ctx);
         }
 
         runtime.gc_regist(type_info);
@@ -1693,8 +2252,8 @@ namespace luaxc {
         return false;
     }
 
-    bool IRInterpreter::handle_member_load(IRLoadMemberParam param) {
-        auto name = param.identifier;
+    bool IRInterpreter::handle_member_load(IRMemberSite& site) {
+        auto name = site.identifier;
         auto object = pop_op_stack();
 
         if (!object.is_gc_object()) {
@@ -1709,30 +2268,58 @@ namespace luaxc {
 
         auto* object_ptr = object.get_inner_value<GCObject*>();
 
-        if (object_ptr->storage.fields.find(name) == object_ptr->storage.fields.end()) {
-            auto* op_member_load = runtime.push_string_pool_if_not_exists("opMemberLoad");
+        if (auto* shape = object_ptr->storage.shape) {
+            auto& cache = site.cache;
+
+            if (auto* entry = cache.find(shape)) {
+                if (entry->method) {
+                    push_op_stack(PrimValue(ValueType::Function, entry->method));
+                } else {
+                    push_op_stack(object_ptr->storage.slots[entry->offset]);
+                }
+                return false;
+            }
+
+            if (auto offset = shape->lookup(name)) {
+                cache.insert(shape, *offset);
+                push_op_stack(object_ptr->storage.slots[*offset]);
+                return false;
+            }
+
+            // the shape pins the type, so its methods can be cached as well
+            if (auto* method = shape->get_owner()->find_method(name)) {
+                cache.insert_method(shape, method);
+                push_op_stack(PrimValue(ValueType::Function, method));
+                return false;
+            }
+        }
+
+        auto member = object_ptr->find_member(name);
+
+        if (!member) {
+            auto op_member_load = object_ptr->find_member(runtime.push_string_pool_if_not_exists("opMemberLoad"));
 
-            if (object_ptr->storage.fields.find(op_member_load) == object_ptr->storage.fields.end()) {
+            if (!op_member_load) {
                 std::string name_str = name->to_string();
                 throw IRInterpreterException("Object does not contain such field: " + name_str);
             }
 
             push_op_stack(PrimValue(ValueType::String, (GCObject*){name}));
             push_op_stack(object);
-            push_op_stack(object_ptr->storage.fields[op_member_load]);
+            push_op_stack(*op_member_load);
 
             bool jumped = handle_function_invocation(IRCallParam{2});
 
             return jumped;
         }
 
-        push_op_stack(object_ptr->storage.fields[name]);
+        push_op_stack(*member);
 
         return false;
     }
 
-    bool IRInterpreter::handle_member_store(IRStoreMemberParam param) {
-        auto name = param.identifier;
+    bool IRInterpreter::handle_member_store(IRMemberSite& site) {
+        auto name = site.identifier;
         auto value = pop_op_stack();
         auto object = pop_op_stack();
 
@@ -1742,10 +2329,45 @@ namespace luaxc {
 
         auto* object_ptr = object.get_inner_value<GCObject*>();
 
-        if (object_ptr->storage.fields.find(name) == object_ptr->storage.fields.end()) {
-            auto* op_member_store = runtime.push_string_pool_if_not_exists("opMemberStore");
+        if (auto* shape = object_ptr->storage.shape) {
+            auto& cache = site.cache;
+
+            auto* entry = cache.find(shape);
+            if (!entry) {
+                if (auto offset = shape->lookup(name)) {
+                    cache.insert(shape, *offset);
+                    entry = cache.find(shape);
+                }
+            }
+
+            if (entry) {
+                auto& slot = object_ptr->storage.slots[entry->offset];
+                runtime.get_gc().deletion_barrier(slot);
+                slot = value;
+                runtime.get_gc().write_barrier(object_ptr, value);
+                return false;
+            }
+        }
+
+        auto* field = object_ptr->find_field(name);
+
+        if (!field && object_ptr->find_method(name)) {
+            // assigning over a method gives this object its own field that shadows the type's method,
+            // loads look at the object's fields first
+            if (auto* shape = object_ptr->storage.shape) {
+                object_ptr->storage.shape = shape->add_field(name, nullptr);
+                object_ptr->storage.slots.push_back(value);
+            } else {
+                object_ptr->storage.fields[name] = value;
+            }
+            runtime.get_gc().write_barrier(object_ptr, value);
+            return false;
+        }
+
+        if (!field) {
+            auto op_member_store = object_ptr->find_member(runtime.push_string_pool_if_not_exists("opMemberStore"));
 
-            if (object_ptr->storage.fields.find(op_member_store) == object_ptr->storage.fields.end()) {
+            if (!op_member_store) {
                 std::string name_str = name->to_string();
                 throw IRInterpreterException("Object does not contain such field: " + name_str);
             }
@@ -1753,18 +2375,18 @@ namespace luaxc {
             push_op_stack(value);
             push_op_stack(PrimValue(ValueType::String, (GCObject*){name}));
             push_op_stack(object);
-            push_op_stack(object_ptr->storage.fields[op_member_store]);
+            push_op_stack(*op_member_store);
 
             bool jumped = handle_function_invocation(IRCallParam{3, true});
 
             return jumped;
-        } else {
-            // force the type of the value to the desired member type
-            // as sometimes the member type can be 'Any'
-            value.set_type_info(object.get_type_info()->get_field(name).type_ptr);
         }
 
-        object_ptr->storage.fields[name] = value;
+        // heap values carry their type with them and primitives derive it from the tag,
+        // so there is nothing to coerce here.
+        runtime.get_gc().deletion_barrier(*field);
+        *field = value;
+        runtime.get_gc().write_barrier(object_ptr, value);
 
         return false;
     }
@@ -1777,12 +2399,12 @@ namespace luaxc {
 
         if (object.is_gc_object()) {
             auto* gc_object = object.get_inner_value<GCObject*>();
-            auto* op_index_at = runtime.push_string_pool_if_not_exists("opIndexAt");
+            auto op_index_at = gc_object->find_member(runtime.push_string_pool_if_not_exists("opIndexAt"));
 
-            if (gc_object->storage.fields.find(op_index_at) != gc_object->storage.fields.end()) {
+            if (op_index_at) {
                 push_op_stack(index);
                 push_op_stack(object);
-                push_op_stack(gc_object->storage.fields[op_index_at]);
+                push_op_stack(*op_index_at);
 
                 jumped = handle_function_invocation(IRCallParam{2});
 
@@ -1804,13 +2426,13 @@ namespace luaxc {
 
         if (object.is_gc_object()) {
             auto* gc_object = object.get_inner_value<GCObject*>();
-            auto* op_index_at = runtime.push_string_pool_if_not_exists("opIndexAssign");
+            auto op_index_assign = gc_object->find_member(runtime.push_string_pool_if_not_exists("opIndexAssign"));
 
-            if (gc_object->storage.fields.find(op_index_at) != gc_object->storage.fields.end()) {
+            if (op_index_assign) {
                 push_op_stack(value);
                 push_op_stack(index);
                 push_op_stack(object);
-                push_op_stack(gc_object->storage.fields[op_index_at]);
+                push_op_stack(*op_index_assign);
 
                 jumped = handle_function_invocation(IRCallParam{3, true});
 
@@ -1821,56 +2443,53 @@ namespace luaxc {
         throw IRInterpreterException("The object is neither an array nor an object with 'opIndexAssign' method");
     }
 
-    void IRInterpreter::handle_module_load(IRLoadModuleParam param) {
-        auto* module = runtime.get_module(param.module_id).module;
+    void IRInterpreter::handle_module_load(size_t module_id) {
+        auto* module = runtime.get_module(module_id).module;
 
         auto value = PrimValue(ValueType::Module, (GCObject*){module});
         push_op_stack(value);
     }
 
-    void IRInterpreter::handle_make_string() {
-        auto string_literal_ref = pop_op_stack();
-
-        StringObject* string_object = new StringObject(
-                *static_cast<StringObject*>(string_literal_ref.get_inner_value<GCObject*>()));
-        runtime.init_type_info(string_object, "String");
-
-        string_object->no_collect = false;
-
-        runtime.gc_regist(string_object);
-
-        auto value = IRPrimValue(ValueType::String, (GCObject*){string_object});
-        push_op_stack(value);
-    }
-
-    void IRInterpreter::handle_make_function(IRMakeFunctionParam param) {
+    void IRInterpreter::handle_make_function(const IRMakeFunctionParam& param) {
         auto guard = runtime.gc_guard();
 
-        FunctionObject* func_obj;
-        if (param.is_method) {
-            func_obj = FunctionObject::create_method(param.begin_offset, param.module_id, param.arity);
-        } else {
-            func_obj = FunctionObject::create_function(param.begin_offset, param.module_id, param.arity);
-        }
+        auto* func_obj = runtime.gc_allocate<FunctionObject>(
+                param.begin_offset, param.module_id, param.arity, param.is_method);
+        func_obj->set_local_slot_names(param.locals);
+        func_obj->set_name(param.name);
 
         // don't freeze context when not necessary
         if (param.is_closure) {
-            auto* ctx = freeze_context();
+            auto& frame = current_stack_frame();
 
-            if (has_context()) {
-                ctx->set_next(get_context());
+            for (auto& upvalue: param.upvalues) {
+                if (upvalue.from_local) {
+                    func_obj->add_upvalue(capture_upvalue(upvalue.name, frame.window_base + upvalue.index));
+                } else {
+                    func_obj->add_upvalue(frame.function->get_upvalue(upvalue.index));
+                }
             }
 
-            func_obj->set_context(ctx);
-        }
+            if (frame.window && frame.variables.empty()) {
+                // made right inside a function, whose locals are reached through upvalues.
+                // there is nothing left in the frame to freeze.
+                func_obj->set_context(has_context() ? get_context() : nullptr);
+            } else {
+                auto* ctx = freeze_context();
+
+                if (has_context()) {
+                    ctx->set_next(get_context());
+                }
 
-        runtime.gc_regist(func_obj);
+                func_obj->set_context(ctx);
+            }
+        }
 
         auto value = IRPrimValue(ValueType::Function, (GCObject*){func_obj});
         push_op_stack(value);
     }
 
-    void IRInterpreter::handle_make_object(IRMakeObjectParam param) {
+    void IRInterpreter::handle_make_object(const std::vector<StringObject*>& fields) {
         auto guard = runtime.gc_guard();
 
         auto type = pop_op_stack();
@@ -1880,18 +2499,13 @@ namespace luaxc {
 
         auto* type_info = static_cast<TypeObject*>(type.get_inner_value<GCObject*>());
 
-        auto& fields = param.fields;
-        auto* gc_object = new GCObject();
+        auto* gc_object = runtime.gc_allocate<GCObject>();
 
         bool validation_enabled = type_info != TypeObject::any();
 
-        for (auto [name, _]: type_info->get_fields()) {
-            gc_object->storage.fields[name] = PrimValue::null();
-        }
-
-        for (auto [name, fn]: type_info->get_methods()) {
-            gc_object->storage.fields[name] = PrimValue(ValueType::Function, fn);
-        }
+        auto* shape = type_info->get_root_shape();
+        gc_object->storage.slots.assign(shape->get_slot_count(), PrimValue::null());
+        gc_object->storage.prototype = type_info;
 
         for (auto* field: fields) {
             // validation
@@ -1899,21 +2513,33 @@ namespace luaxc {
                 throw IRInterpreterException("Object has no field named: " + field->to_string());
             }
 
-            gc_object->storage.fields[field] = pop_op_stack();
+            auto offset = shape->lookup(field);
+            if (!offset && validation_enabled) {
+                throw IRInterpreterException("Cannot initialize method: " + field->to_string());
+            }
+
+            if (!offset) {
+                // untyped objects grow their shape along the transition chain
+                shape = shape->add_field(field, nullptr);
+                offset = shape->get_slot_count() - 1;
+                gc_object->storage.slots.emplace_back();
+            }
+
+            gc_object->storage.slots[*offset] = pop_op_stack();
         }
 
+        gc_object->storage.shape = shape;
+
         auto value = PrimValue(ValueType::Object, (GCObject*){gc_object});
         value.set_type_info(type_info);
 
-        runtime.gc_regist(gc_object);
-
         push_op_stack(value);
     }
 
-    void IRInterpreter::handle_make_module(IRMakeModuleParam param) {
+    void IRInterpreter::handle_make_module(size_t module_id) {
         auto* gc_object = handle_make_module_local();
 
-        auto& module_registry_metadata = runtime.get_module(param.module_id);
+        auto& module_registry_metadata = runtime.get_module(module_id);
         module_registry_metadata.module = gc_object;
     }
 
@@ -1933,7 +2559,9 @@ namespace luaxc {
 
         auto* ctx = freeze_context();
         for (auto* fn: functions) {
+            runtime.get_gc().deletion_barrier(fn->get_context());
             fn->set_context(ctx);
+            runtime.get_gc().write_barrier(fn, ctx);
         }
 
         auto value = PrimValue(ValueType::Module, (GCObject*){gc_object});
@@ -1996,7 +2624,7 @@ namespace luaxc {
             }
 
             load_context(fn->get_context());
-            push_stack_frame(false, param.force_pop_return_value);
+            push_function_stack_frame(fn, param.force_pop_return_value);
             size_t jump_target =
                     runtime.resolve_function_offset(
                             fn->get_module_id(),
@@ -2007,6 +2635,78 @@ namespace luaxc {
         }
     }
 
+    void IRInterpreter::handle_local_declaration(size_t slot) {
+        current_stack_frame().slot(slot) = IRPrimValue::null();
+    }
+
+    void IRInterpreter::handle_local_load(size_t slot) {
+        auto& frame = current_stack_frame();
+        auto& value = frame.slot(slot);
+        if (value.get_type() != ValueType::Unknown) {
+            push_op_stack(value);
+            return;
+        }
+
+        // not declared yet, fall back to what a name lookup would find
+        push_op_stack(retrieve_raw_value((*frame.slot_names)[slot]));
+    }
+
+    void IRInterpreter::handle_local_store(size_t slot) {
+        auto value = pop_op_stack();
+
+        auto& frame = current_stack_frame();
+        auto& target = frame.slot(slot);
+        if (target.get_type() != ValueType::Unknown) {
+            target = value;
+            return;
+        }
+
+        store_raw_value((*frame.slot_names)[slot], value);
+    }
+
+    void IRInterpreter::handle_upvalue_load(size_t index) {
+        auto* upvalue = current_stack_frame().function->get_upvalue(index);
+        auto& value = upvalue->get();
+        if (value.get_type() != ValueType::Unknown) {
+            push_op_stack(value);
+            return;
+        }
+
+        // captured before its declaration ran, fall back to what a name lookup would find
+        push_op_stack(retrieve_raw_value(upvalue->get_name()));
+    }
+
+    UpvalueObject* IRInterpreter::capture_upvalue(StringObject* name, size_t stack_index) {
+        // open upvalues of the current frame sit at the back, share them between closures
+        for (auto it = open_upvalues.rbegin(); it != open_upvalues.rend(); ++it) {
+            if ((*it)->get_stack_index() < current_stack_frame().window_base) {
+                break;
+            }
+
+            if ((*it)->get_stack_index() == stack_index) {
+                return *it;
+            }
+        }
+
+        auto* upvalue = runtime.gc_allocate<UpvalueObject>(name, &stack, stack_index);
+
+        // only closures hold on to upvalues, keep open ones alive for close_upvalues
+        upvalue->no_collect = true;
+
+        open_upvalues.push_back(upvalue);
+        return upvalue;
+    }
+
+    void IRInterpreter::close_upvalues(size_t stack_base) {
+        while (!open_upvalues.empty() && open_upvalues.back()->get_stack_index() >= stack_base) {
+            auto* upvalue = open_upvalues.back();
+            upvalue->close();
+            upvalue->no_collect = false;
+            runtime.get_gc().write_barrier(upvalue, upvalue->get());
+            open_upvalues.pop_back();
+        }
+    }
+
     void IRInterpreter::handle_return() {
         auto return_addr = current_stack_frame().return_addr;
         pop_stack_frame();
@@ -2029,20 +2729,20 @@ namespace luaxc {
         // by default, the converted lhs must be a gc object
         auto* lhs_object = lhs.get_inner_value<GCObject*>();
 
-        if (lhs_object->storage.fields.find(dispatch_operator_identifier) != lhs_object->storage.fields.end()) {
+        if (auto lhs_operator = lhs_object->find_member(dispatch_operator_identifier)) {
             push_op_stack(rhs);
             push_op_stack(lhs);
-            push_op_stack(lhs_object->storage.fields[dispatch_operator_identifier]);
+            push_op_stack(*lhs_operator);
 
             return handle_function_invocation(IRCallParam{2});
         } else if (rhs.is_gc_object()) {
             // if the lhs does not have a dispatched operator, try to see if the rhs has one
 
             auto* rhs_object = rhs.get_inner_value<GCObject*>();
-            if (rhs_object->storage.fields.find(dispatch_operator_identifier) != rhs_object->storage.fields.end()) {
+            if (auto rhs_operator = rhs_object->find_member(dispatch_operator_identifier)) {
                 push_op_stack(lhs);
                 push_op_stack(rhs);
-                push_op_stack(rhs_object->storage.fields[dispatch_operator_identifier]);
+                push_op_stack(*rhs_operator);
 
                 return handle_function_invocation(IRCallParam{2});
             }
@@ -2059,6 +2759,82 @@ namespace luaxc {
         return handle_binary_op(op, lhs_variant, rhs_variant);
     }
 
+    static std::optional<IRInstruction::InstructionType> select_quickened_binary_op(
+            IRInstruction::InstructionType op, const IRPrimValue& lhs, const IRPrimValue& rhs) {
+        using InstructionType = IRInstruction::InstructionType;
+
+        if (lhs.is_int() && rhs.is_int()) {
+            switch (op) {
+                case InstructionType::ADD:
+                    return InstructionType::ADD_INT_INT;
+                case InstructionType::SUB:
+                    return InstructionType::SUB_INT_INT;
+                case InstructionType::MUL:
+                    return InstructionType::MUL_INT_INT;
+                case InstructionType::MOD:
+                    return InstructionType::MOD_INT_INT;
+                case InstructionType::CMP_EQ:
+                    return InstructionType::CMP_EQ_INT_INT;
+                case InstructionType::CMP_NE:
+                    return InstructionType::CMP_NE_INT_INT;
+                case InstructionType::CMP_LT:
+                    return InstructionType::CMP_LT_INT_INT;
+                case InstructionType::CMP_GT:
+                    return InstructionType::CMP_GT_INT_INT;
+                case InstructionType::CMP_LE:
+                    return InstructionType::CMP_LE_INT_INT;
+                case InstructionType::CMP_GE:
+                    return InstructionType::CMP_GE_INT_INT;
+                default:
+                    return std::nullopt;
+            }
+        }
+
+        if (lhs.is_float() && rhs.is_float()) {
+            switch (op) {
+                case InstructionType::ADD:
+                    return InstructionType::ADD_FLOAT_FLOAT;
+                case InstructionType::SUB:
+                    return InstructionType::SUB_FLOAT_FLOAT;
+                case InstructionType::MUL:
+                    return InstructionType::MUL_FLOAT_FLOAT;
+                case InstructionType::CMP_LT:
+                    return InstructionType::CMP_LT_FLOAT_FLOAT;
+                case InstructionType::CMP_GT:
+                    return InstructionType::CMP_GT_FLOAT_FLOAT;
+                case InstructionType::CMP_LE:
+                    return InstructionType::CMP_LE_FLOAT_FLOAT;
+                case InstructionType::CMP_GE:
+                    return InstructionType::CMP_GE_FLOAT_FLOAT;
+                default:
+                    return std::nullopt;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    void IRInterpreter::quicken_binary_op(IRInstruction& instruction) {
+        if (instruction.operand >= max_deoptimizations) {
+            return;
+        }
+
+        auto& rhs = stack[stack.size() - 1];
+        auto& lhs = stack[stack.size() - 2];
+
+        if (auto quickened = select_quickened_binary_op(instruction.type, lhs, rhs)) {
+            instruction.type = quickened.value();
+        }
+    }
+
+    bool IRInterpreter::deoptimize_binary_op(IRInstruction::InstructionType generic_op) {
+        auto& instruction = byte_code[pc];
+        instruction.type = generic_op;
+        instruction.operand++;
+
+        return handle_binary_op(generic_op);
+    }
+
     bool IRInterpreter::handle_unary_op(IRInstruction::InstructionType op) {
         auto rhs_variant = pop_op_stack();
 
@@ -2161,9 +2937,9 @@ namespace luaxc {
         auto* dispatch_operator_identifier = runtime.push_string_pool_if_not_exists(identifier);
 
         auto* object = value.get_inner_value<GCObject*>();
-        if (object->storage.fields.find(dispatch_operator_identifier) != object->storage.fields.end()) {
+        if (auto unary_operator = object->find_member(dispatch_operator_identifier)) {
             push_op_stack(value);
-            push_op_stack(object->storage.fields[dispatch_operator_identifier]);
+            push_op_stack(*unary_operator);
 
             return handle_function_invocation(IRCallParam{1});
         }
@@ -2253,6 +3029,37 @@ namespace luaxc {
         return has_identifier(runtime.push_string_pool_if_not_exists(identifier));
     }
 
+    void IRInterpreter::sample_call_stack(HeapProfiler::CallStack& stack) const {
+        for (auto& frame: stack_frames) {
+            // frames of blocks have no function
+            if (frame.function != nullptr) {
+                stack.functions.push_back(frame.function);
+            }
+        }
+        stack.pc = pc;
+    }
+
+    void IRRuntime::start_heap_profile() {
+        gc.start_profiling([this](HeapProfiler::CallStack& stack) {
+            if (interpreter) {
+                interpreter->sample_call_stack(stack);
+            }
+        });
+    }
+
+    void IRRuntime::write_heap_profile(const std::string& path) const {
+        auto* profiler = gc.get_profiler();
+        if (profiler == nullptr) {
+            throw std::runtime_error("Heap profiling was not started");
+        }
+
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Cannot write heap profile to " + path);
+        }
+        profiler->write_folded(out);
+    }
+
     std::unique_ptr<AstNode> IRRuntime::generate(const std::string& input, const std::string& filename, Parser::ParserState init_state) {
         auto lexer = Lexer(input, filename);
         auto parser = Parser(lexer);
@@ -2280,7 +3087,8 @@ namespace luaxc {
         }
 
         gc.init(interpreter->get_op_stack_ptr(),
-                interpreter->get_stack_frames_ptr());
+                interpreter->get_stack_frames_ptr(),
+                interpreter->get_context_stack_ptr());
 
         gc.set_gc_enabled(true);
 
@@ -2314,7 +3122,8 @@ namespace luaxc {
         }
 
         gc.init(interpreter->get_op_stack_ptr(),
-                interpreter->get_stack_frames_ptr());
+                interpreter->get_stack_frames_ptr(),
+                interpreter->get_context_stack_ptr());
 
         gc.set_gc_enabled(true);
 
@@ -2416,7 +3225,7 @@ namespace luaxc {
     FrozenContextObject* IRInterpreter::freeze_context() {
         auto guard = runtime.gc_guard();
 
-        auto* ctx = new FrozenContextObject();
+        auto* ctx = runtime.gc_allocate<FrozenContextObject>();
 
         std::deque<SharedStackFrameRef> frozen;
 
@@ -2433,8 +3242,6 @@ namespace luaxc {
 
         ctx->set_stack_frame(std::vector(frozen.begin(), frozen.end()));
 
-        runtime.gc_regist(ctx);
-
         return ctx;
     }
 
@@ -2450,11 +3257,35 @@ namespace luaxc {
         stack_frames.emplace_back(return_addr, allow_propagation, force_pop_return_value);
     }
 
+    void IRInterpreter::push_function_stack_frame(FunctionObject* fn, bool force_pop_return_value) {
+        push_stack_frame(false, force_pop_return_value);
+
+        // the arguments on top of the stack become the first slots,
+        // the remaining locals start out undeclared right above them.
+        auto& names = fn->get_local_slot_names();
+        size_t base = stack.size() - fn->get_arity();
+        current_stack_frame().bind_window(&stack, base, names);
+        current_stack_frame().function = fn;
+        stack.resize(base + current_stack_frame().slot_count());
+    }
+
     void IRInterpreter::pop_stack_frame() {
         auto& frame = stack_frames.back();
 
         // set the value of all the pending StackFrameRefs
         frame.notify_return();
+        for (auto& ref: frame.pending_refs) {
+            runtime.get_gc().remember_frame(ref);
+        }
+
+        // drop the slot window, keeping the return value on top
+        if (frame.window) {
+            close_upvalues(frame.window_base);
+
+            auto ret = stack.back();
+            stack.resize(frame.window_base);
+            stack.push_back(ret);
+        }
 
         // pop the return value, if requested
         if (frame.force_pop_return_value) {
@@ -2464,6 +3295,11 @@ namespace luaxc {
         stack_frames.pop_back();
     }
 
+    void IRInterpreter::reserve_stacks() {
+        stack_frames.reserve(LUAXC_RUNTIME_MAX_STACK_SIZE);
+        stack.reserve(LUAXC_RUNTIME_MAX_STACK_SIZE * 16);
+    }
+
     StackFrame& IRInterpreter::current_stack_frame() {
         assert(stack_frames.size() > 0);
         return stack_frames.back();
@@ -2476,8 +3312,8 @@ namespace luaxc {
 
     std::optional<PrimValue> IRInterpreter::retrieve_identifier_in_stack_frame(StringObject* identifier) {
         for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); frame++) {
-            if (frame->variables.find(identifier) != frame->variables.end()) {
-                return {frame->variables[identifier]};
+            if (auto* value = frame->find_variable(identifier)) {
+                return {*value};
             }
 
             if (!frame->allow_upward_propagation) {
@@ -2490,8 +3326,8 @@ namespace luaxc {
 
     std::optional<PrimValue*> IRInterpreter::retrieve_identifier_ref_in_stack_frame(StringObject* identifier) {
         for (auto frame = stack_frames.rbegin(); frame != stack_frames.rend(); frame++) {
-            if (frame->variables.find(identifier) != frame->variables.end()) {
-                return {&frame->variables[identifier]};
+            if (auto* value = frame->find_variable(identifier)) {
+                return {value};
             }
 
             if (!frame->allow_upward_propagation) {
@@ -2546,13 +3382,14 @@ namespace luaxc {
     void IRRuntime::init_type_info(GCObject* object, const std::string& type_name) {
         TypeObject* type = get_type_info(type_name);
 
+        // methods stay on the type, only data fields are materialized
         for (auto [name, _]: type->get_fields()) {
-            object->storage.fields[name] = PrimValue::null();
+            if (!type->has_method(name)) {
+                object->storage.fields[name] = PrimValue::null();
+            }
         }
 
-        for (auto [name, fn]: type->get_methods()) {
-            object->storage.fields[name] = PrimValue(ValueType::Function, fn);
-        }
+        object->storage.prototype = type;
     }
 
     void IRRuntime::invoke_function(FunctionObject* function, std::vector<PrimValue> args, bool force_discard_return_value, ssize_t jump_offset) {
@@ -2577,7 +3414,7 @@ namespace luaxc {
         }
 
         interpreter->load_context(function->get_context());
-        interpreter->push_stack_frame();
+        interpreter->push_function_stack_frame(function);
 
         size_t jump_target =
                 resolve_function_offset(
@@ -2598,4 +3435,10 @@ namespace luaxc {
             gc_regist_no_collect(type);
         }
     }
+
+    void IRRuntime::init_single_byte_strings() {
+        for (size_t byte = 0; byte < single_byte_strings.size(); byte++) {
+            single_byte_strings[byte] = push_string_pool_if_not_exists(std::string(1, static_cast<char>(byte)));
+        }
+    }
 }// namespace luaxc
\ No newline at end of file
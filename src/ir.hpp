@@ -1,9 +1,9 @@
 #pragma once
 
-#include <list>
 #define LUAXC_RUNTIME_MAX_STACK_SIZE 1024
 #define LUAXC_RUNTIME_STACK_OVERFLOW_PROTECTION_ENABLED
 
+#include <array>
 #include <cmath>
 #include <optional>
 #include <stack>
@@ -42,34 +42,48 @@ namespace luaxc {
     };
 
     using IRPrimValue = PrimValue;
-    using IRLoadConstParam = IRPrimValue;
 
-    struct IRLoadIdentifierParam {
-        StringObject* identifier;
-    };
+    // per-instruction polymorphic cache for member access on shaped objects.
+    // keyed by shape id rather than pointer, shapes die with their types.
+    struct MemberInlineCache {
+        static constexpr size_t max_entries = 4;
 
-    struct IRStoreIdentifierParam {
-        StringObject* identifier;
-    };
+        struct Entry {
+            uint64_t shape_id;
+            size_t offset;
+            // set when the member resolved to a method of the shape's type
+            FunctionObject* method;
+        };
 
-    struct IRDeclareIdentifierParam {
-        StringObject* identifier;
-    };
+        Entry entries[max_entries];
+        size_t size = 0;
 
-    struct IRLoadModuleParam {
-        size_t module_id;
-    };
+        const Entry* find(const Shape* shape) const {
+            for (size_t i = 0; i < size; i++) {
+                if (entries[i].shape_id == shape->get_id()) {
+                    return &entries[i];
+                }
+            }
+            return nullptr;
+        }
 
-    struct IRLoadMemberParam {
-        StringObject* identifier;
-    };
+        // megamorphic sites keep cycling through the last slot
+        void insert(const Shape* shape, size_t offset) {
+            next_entry() = Entry{shape->get_id(), offset, nullptr};
+        }
+
+        void insert_method(const Shape* shape, FunctionObject* method) {
+            next_entry() = Entry{shape->get_id(), 0, method};
+        }
 
-    struct IRMakeObjectParam {
-        std::vector<StringObject*> fields;
+    private:
+        Entry& next_entry() { return entries[size < max_entries ? size++ : max_entries - 1]; }
     };
 
-    struct IRStoreMemberParam {
+    // operand of LOAD_MEMBER / STORE_MEMBER
+    struct IRMemberSite {
         StringObject* identifier;
+        MemberInlineCache cache;
     };
 
     using IRJumpParam = size_t;
@@ -86,8 +100,12 @@ namespace luaxc {
         // so we need to manually discard it.
     };
 
-    struct IRMakeModuleParam {
-        size_t module_id;
+    // where a closure picks up a captured variable when it is made:
+    // a slot of the enclosing function, or one of the enclosing closure's upvalues.
+    struct IRUpvalueDesc {
+        StringObject* name;
+        bool from_local;
+        size_t index;
     };
 
     struct IRMakeFunctionParam {
@@ -96,15 +114,26 @@ namespace luaxc {
         size_t arity;
         bool is_method;
         bool is_closure;
+        LocalSlotNames locals = nullptr;
+        std::vector<IRUpvalueDesc> upvalues = {};
+        // declared functions and methods, closures have none
+        StringObject* name = nullptr;
     };
 
+    // packed, fixed-width instruction. the operand is an immediate (slot, module id,
+    // argument count, jump offset) or an index into the runtime's IRConstantTables.
     class IRInstruction {
     public:
-        enum class InstructionType {
+        enum class InstructionType : uint8_t {
             LOAD_CONST,        // load a const to stack
             DECLARE_IDENTIFIER,// declare an identifier
             LOAD_IDENTIFIER,   // load an identifier to stack
             STORE_IDENTIFIER,  // store stack top to an identifier
+            DECLARE_LOCAL,     // declare a slot-resolved local of the current function frame
+            LOAD_LOCAL,        // load a slot-resolved local to stack
+            STORE_LOCAL,       // store stack top to a slot-resolved local
+            LOAD_UPVALUE,      // load a variable captured by the current closure
+            STORE_UPVALUE,     // captured variables are immutable, always raises
             LOAD_MODULE,       // load a module to stack
             ADD,               // pop two values from stack, add them and push result to stack
             SUB,
@@ -136,6 +165,7 @@ namespace luaxc {
 
             JMP_REL,         // relative jump
             JMP_IF_FALSE_REL,// relative jump with condition
+            JMP_IF_TRUE_REL, // relative jump with inverted condition
 
             POP_STACK,// pop value from stack
             PEEK,     // duplicate stack top
@@ -144,7 +174,6 @@ namespace luaxc {
 
             MAKE_OBJECT,// make an object. pop a sequence of values from stack
 
-            MAKE_STRING,
             MAKE_FUNC,
             MAKE_RULE,
 
@@ -164,35 +193,102 @@ namespace luaxc {
 
             CALL,
             RET,
+
+            // quickened binary ops. the interpreter rewrites a generic op in place into one
+            // of these after observing its operand types, they guard on the types and
+            // deoptimize back to the generic op. the operand counts the deoptimizations.
+            ADD_INT_INT,
+            ADD_FLOAT_FLOAT,
+            SUB_INT_INT,
+            SUB_FLOAT_FLOAT,
+            MUL_INT_INT,
+            MUL_FLOAT_FLOAT,
+            MOD_INT_INT,
+            CMP_EQ_INT_INT,
+            CMP_NE_INT_INT,
+            CMP_LT_INT_INT,
+            CMP_LT_FLOAT_FLOAT,
+            CMP_GT_INT_INT,
+            CMP_GT_FLOAT_FLOAT,
+            CMP_LE_INT_INT,
+            CMP_LE_FLOAT_FLOAT,
+            CMP_GE_INT_INT,
+            CMP_GE_FLOAT_FLOAT,
+
+            // fused compare-and-branch, always followed by the JMP_IF_FALSE_REL carrying the offset.
+            // numeric operands branch right away, anything else compares generically
+            // and leaves the result to the following jump.
+            CMP_EQ_JMP_IF_FALSE,
+            CMP_NE_JMP_IF_FALSE,
+            CMP_LT_JMP_IF_FALSE,
+            CMP_GT_JMP_IF_FALSE,
+            CMP_LE_JMP_IF_FALSE,
+            CMP_GE_JMP_IF_FALSE,
+
+            HALT,// end of byte code, appended by the interpreter
         };
 
-        using IRParam = std::variant<
-                std::monostate,
-                IRLoadConstParam,
-                IRDeclareIdentifierParam,
-                IRLoadIdentifierParam,
-                IRLoadModuleParam,
-                IRStoreIdentifierParam,
-                IRJumpParam,
-                IRJumpRelParam,
-                IRCallParam,
-                IRLoadMemberParam,
-                IRStoreMemberParam,
-                IRMakeFunctionParam,
-                IRMakeObjectParam,
-                IRMakeModuleParam>;
-
-        IRParam param;
         InstructionType type;
+        uint32_t operand;
 
-        IRInstruction(InstructionType type, IRParam param) : param(param), type(type) {}
+        explicit IRInstruction(InstructionType type, uint32_t operand = 0) : type(type), operand(operand) {}
 
-        std::string dump() const;
+        static IRInstruction relative_jump(InstructionType type, ssize_t offset) {
+            IRInstruction instruction(type);
+            instruction.set_jump_offset(offset);
+            return instruction;
+        }
+
+        ssize_t get_jump_offset() const { return static_cast<int32_t>(operand); }
+
+        void set_jump_offset(ssize_t offset) { operand = static_cast<uint32_t>(static_cast<int32_t>(offset)); }
+    };
+
+    static_assert(sizeof(IRInstruction) == 8, "instructions are expected to stay packed");
+
+    // operand tables shared by every module compiled into a runtime,
+    // as modules are linked into one byte code stream.
+    class IRConstantTables {
+    public:
+        uint32_t add_constant(const PrimValue& value);
+
+        uint32_t add_identifier(StringObject* identifier);
+
+        uint32_t add_member_site(StringObject* identifier);
+
+        uint32_t add_field_list(std::vector<StringObject*> fields);
+
+        uint32_t add_function(const IRMakeFunctionParam& function);
+
+        const PrimValue& get_constant(uint32_t index) const { return constants[index]; }
+
+        StringObject* get_identifier(uint32_t index) const { return identifiers[index]; }
+
+        IRMemberSite& get_member_site(uint32_t index) { return member_sites[index]; }
+
+        const IRMemberSite& get_member_site(uint32_t index) const { return member_sites[index]; }
+
+        const std::vector<StringObject*>& get_field_list(uint32_t index) const { return field_lists[index]; }
+
+        const IRMakeFunctionParam& get_function(uint32_t index) const { return functions[index]; }
+
+    private:
+        std::vector<PrimValue> constants;
+        std::vector<StringObject*> identifiers;
+        std::unordered_map<StringObject*, uint32_t> identifier_indices;
+        std::vector<IRMemberSite> member_sites;
+        std::vector<std::vector<StringObject*>> field_lists;
+        std::vector<IRMakeFunctionParam> functions;
+
+        template<typename T>
+        static uint32_t next_index(const std::vector<T>& table);
     };
 
     using ByteCode = std::vector<IRInstruction>;
 
-    std::string dump_bytecode(const ByteCode& bytecode);
+    std::string dump_instruction(const IRInstruction& instruction, const IRConstantTables& tables);
+
+    std::string dump_bytecode(const ByteCode& bytecode, const IRConstantTables& tables);
 
     class IRRuntime;
 
@@ -223,10 +319,30 @@ namespace luaxc {
             void register_continue_instruction(size_t instruction) { continue_instructions.push_back(instruction); }
         };
 
+        struct LocalScope {
+            // derived scopes (types, modules, rules) keep their variables by name,
+            // as MAKE_TYPE and friends collect them from the stack frame.
+            bool resolvable = false;
+            std::unordered_map<StringObject*, size_t> slots;
+            std::vector<StringObject*> names;
+
+            // closures reach the locals of their enclosing functions through upvalues
+            bool captures = false;
+            std::vector<IRUpvalueDesc> upvalues;
+
+            size_t declare(StringObject* identifier);
+
+            std::optional<size_t> resolve(StringObject* identifier) const;
+
+            size_t capture(const IRUpvalueDesc& upvalue);
+        };
+
         std::unique_ptr<luaxc::AstNode> ast;
 
         std::stack<WhileLoopGenerationContext> while_loop_generation_stack;
 
+        std::vector<LocalScope> local_scopes;
+
         IRRuntime& runtime;
 
         std::stack<size_t> compiling_module_ids;
@@ -243,6 +359,32 @@ namespace luaxc {
 
         std::string read_module_file(const std::string& module_file_path);
 
+        IRConstantTables& constant_tables();
+
+        void begin_function_scope(const std::vector<std::unique_ptr<AstNode>>& parameters, const AstNode* body, bool captures = false);
+
+        LocalSlotNames end_function_scope();
+
+        void begin_derived_scope();
+
+        void end_derived_scope();
+
+        void collect_local_declarations(const StatementNode* statement, LocalScope& scope);
+
+        std::optional<size_t> resolve_local(StringObject* identifier) const;
+
+        std::optional<size_t> resolve_upvalue(StringObject* identifier);
+
+        std::optional<size_t> resolve_upvalue_in_scope(size_t scope_index, StringObject* identifier);
+
+        void generate_identifier_declaration(StringObject* identifier, ByteCode& byte_code);
+
+        void generate_identifier_load(StringObject* identifier, ByteCode& byte_code);
+
+        void generate_identifier_store(StringObject* identifier, ByteCode& byte_code);
+
+        void generate_parameters(const std::vector<std::unique_ptr<AstNode>>& parameters, ByteCode& byte_code);
+
         bool is_binary_logical_operator(BinaryExpressionNode::BinaryOperator op);
 
         bool is_combinative_assignment_operator(BinaryExpressionNode::BinaryOperator op);
@@ -273,6 +415,14 @@ namespace luaxc {
 
         void generate_combinative_assignment_statement(const BinaryExpressionNode* statement, ByteCode& byte_code);
 
+        void generate_short_circuit_expression(const BinaryExpressionNode* statement, ByteCode& byte_code);
+
+        // branches on a condition, falling through when it holds.
+        // returns the jumps to patch with the target of the false path.
+        std::vector<size_t> generate_condition(const ExpressionNode* expression, ByteCode& byte_code);
+
+        void patch_jumps(ByteCode& byte_code, const std::vector<size_t>& jumps, size_t target);
+
         void generate_unary_expression_statement(const UnaryExpressionNode* statement, ByteCode& byte_code);
 
         void generate_boolean_literal(const BoolLiteralNode* statement, ByteCode& byte_code);
@@ -326,10 +476,13 @@ namespace luaxc {
         ~IRInterpreter();
 
         IRInterpreter(IRRuntime& runtime, ByteCode byte_code) : IRInterpreter(runtime) {
-            this->byte_code = std::move(byte_code);
+            set_byte_code(std::move(byte_code));
         };
 
-        void set_byte_code(ByteCode byte_code) { this->byte_code = std::move(byte_code); };
+        void set_byte_code(ByteCode byte_code) {
+            this->byte_code = std::move(byte_code);
+            this->byte_code.push_back(IRInstruction(IRInstruction::InstructionType::HALT));
+        };
 
         void run();
 
@@ -361,17 +514,20 @@ namespace luaxc {
 
         std::vector<PrimValue>* get_op_stack_ptr() { return &stack; }
 
-        std::list<StackFrame>* get_stack_frames_ptr() { return &stack_frames; };
+        std::vector<StackFrame>* get_stack_frames_ptr() { return &stack_frames; };
+
+        std::vector<FrozenContextObject*>* get_context_stack_ptr() { return &context_stack; }
 
         void set_program_counter(size_t pc) { this->pc = pc; }
 
         size_t get_program_counter() const { return pc; }
 
-        bool running() const { return pc < byte_code.size(); }
+        // the trailing HALT does not count as a running program
+        bool running() const { return pc + 1 < byte_code.size(); }
 
         struct Snapshot {
             size_t pc;
-            std::list<StackFrame> stack_frames;
+            std::vector<StackFrame> stack_frames;
             std::vector<IRPrimValue> stack;
             std::vector<FrozenContextObject*> context_stack;
         };
@@ -381,22 +537,33 @@ namespace luaxc {
         }
 
         void load_snapshot(Snapshot snapshot) {
+            // upvalues still open above the restored stack would dangle
+            close_upvalues(std::min(stack.size(), snapshot.stack.size()));
+
             pc = snapshot.pc;
             stack_frames = std::move(snapshot.stack_frames);
             stack = std::move(snapshot.stack);
             context_stack = std::move(snapshot.context_stack);
+
+            reserve_stacks();
         }
 
     private:
         ByteCode byte_code;
         size_t pc = 0;
-        std::list<StackFrame> stack_frames;
+        std::vector<StackFrame> stack_frames;
         std::vector<IRPrimValue> stack;
         std::vector<FrozenContextObject*> context_stack;
+        // sorted by stack index, as they can only be opened in the current frame
+        std::vector<UpvalueObject*> open_upvalues;
         IRRuntime& runtime;
 
         void preload_native_functions();
 
+        // frames are referenced by pointer (see StackFrameRef),
+        // so the frame stack must never reallocate.
+        void reserve_stacks();
+
         PrimValue pop_op_stack() {
             auto value = stack.back();
             stack.pop_back();
@@ -411,6 +578,8 @@ namespace luaxc {
 
         void push_stack_frame(bool allow_propagation = false, bool force_pop_return_value = false);
 
+        void push_function_stack_frame(FunctionObject* fn, bool force_pop_return_value = false);
+
         void pop_stack_frame();
 
         void load_context(FrozenContextObject* ctx) { context_stack.push_back(ctx); }
@@ -423,6 +592,9 @@ namespace luaxc {
 
         FrozenContextObject* freeze_context();
 
+        // the script functions being run and the current pc, for the heap profiler
+        void sample_call_stack(HeapProfiler::CallStack& stack) const;
+
         StackFrame& current_stack_frame();
 
         StackFrame& global_stack_frame();
@@ -453,6 +625,13 @@ namespace luaxc {
 
         bool handle_binary_op(IRInstruction::InstructionType op);
 
+        // sites that keep failing their guards stay generic
+        static constexpr uint32_t max_deoptimizations = 4;
+
+        void quicken_binary_op(IRInstruction& instruction);
+
+        bool deoptimize_binary_op(IRInstruction::InstructionType generic_op);
+
         bool dispatch_unary_op(IRPrimValue value, const std::string& identifier);
 
         bool handle_unary_op(IRInstruction::InstructionType op);
@@ -465,23 +644,21 @@ namespace luaxc {
 
         void handle_make_rule();
 
-        bool handle_member_load(IRLoadMemberParam param);
+        bool handle_member_load(IRMemberSite& site);
 
-        bool handle_member_store(IRStoreMemberParam param);
+        bool handle_member_store(IRMemberSite& site);
 
         bool handle_index_load();
 
         bool handle_index_store();
 
-        void handle_module_load(IRLoadModuleParam param);
-
-        void handle_make_string();
+        void handle_module_load(size_t module_id);
 
-        void handle_make_function(IRMakeFunctionParam param);
+        void handle_make_function(const IRMakeFunctionParam& param);
 
-        void handle_make_object(IRMakeObjectParam param);
+        void handle_make_object(const std::vector<StringObject*>& fields);
 
-        void handle_make_module(IRMakeModuleParam param);
+        void handle_make_module(size_t module_id);
 
         GCObject* handle_make_module_local();
 
@@ -493,6 +670,18 @@ namespace luaxc {
 
         void handle_return();
 
+        void handle_local_declaration(size_t slot);
+
+        void handle_local_load(size_t slot);
+
+        void handle_upvalue_load(size_t index);
+
+        UpvalueObject* capture_upvalue(StringObject* name, size_t stack_index);
+
+        void close_upvalues(size_t stack_base);
+
+        void handle_local_store(size_t slot);
+
         bool handle_binary_op(IRInstruction::InstructionType op, IRPrimValue lhs, IRPrimValue rhs);
 
         bool handle_unary_op(IRInstruction::InstructionType op, IRPrimValue rhs);
@@ -507,12 +696,15 @@ namespace luaxc {
 
         IRRuntime() {
             init_builtin_type_info();
+            init_single_byte_strings();
             resolve_runtime_ctx();
         }
 
         IRRuntime(IRRuntime& other) = delete;
         IRRuntime(IRRuntime&& other) {
             constant_pools = std::move(other.constant_pools);
+            constant_tables = std::move(other.constant_tables);
+            single_byte_strings = other.single_byte_strings;
 
             generator = std::move(other.generator);
             interpreter = std::move(other.interpreter);
@@ -556,6 +748,12 @@ namespace luaxc {
 
         void abort(const std::string& reason) { throw std::runtime_error("Runtime aborted: " + reason); }
 
+        // objects allocated from now on are attributed to the script code allocating them
+        void start_heap_profile();
+
+        // writes the live heap as folded stacks, see HeapProfiler::write_folded
+        void write_heap_profile(const std::string& path) const;
+
         IRInterpreter& get_interpreter() {
             return *this->interpreter.get();
         }
@@ -587,8 +785,15 @@ namespace luaxc {
 
         StringObject* push_string_pool_if_not_exists(const std::string& str);
 
+        // pooled strings of one character, so that indexing into a string allocates nothing
+        StringObject* get_single_byte_string(unsigned char byte) const { return single_byte_strings[byte]; }
+
         const ByteCode& get_byte_code() const { return byte_code; }
 
+        IRConstantTables& get_constant_tables() { return constant_tables; }
+
+        const IRConstantTables& get_constant_tables() const { return constant_tables; }
+
         void init_builtin_type_info();
 
         TypeObject* get_type_info(const std::string& name) { return type_info[name]; }
@@ -660,6 +865,10 @@ namespace luaxc {
             std::unordered_map<std::string, StringObject*> string_const_pool;
         } constant_pools;
 
+        std::array<StringObject*, 256> single_byte_strings = {};
+
+        IRConstantTables constant_tables;
+
         std::unique_ptr<IRGenerator> generator = nullptr;
         std::unique_ptr<IRInterpreter> interpreter = nullptr;
 
@@ -676,6 +885,8 @@ namespace luaxc {
 
         GarbageCollector gc;
 
+        void init_single_byte_strings();
+
         void resolve_runtime_ctx();
     };
 }// namespace luaxc
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "lib.hpp"
 #include "ir.hpp"
+#include "string_kernels.hpp"
 #include <iostream>
 
 namespace luaxc {
@@ -140,7 +141,6 @@ namespace luaxc {
             auto& first = args[0];
             if (first.get_type_info() == TypeObject::type()) {
                 if (args.size() != 2) {
-                    delete array;
                     throw IRInterpreterException("Invalid arg size");
                 }
 
@@ -159,7 +159,7 @@ namespace luaxc {
 
                 for (size_t i = 0; i < args.size(); i++) {
                     if (args[i].get_type_info() != candidate_value_type) {
-                        delete array;
+                        // already owned by the collector
                         throw IRInterpreterException("Invalid arg type");
                     }
 
@@ -246,7 +246,9 @@ namespace luaxc {
                 LUAXC_GC_THROW_ERROR_EXPR("Index out of bounds");
             }
 
+            runtime.get_gc().deletion_barrier(array->get_element_ref(idx));
             array->get_element_ref(idx) = args[2];
+            runtime.get_gc().write_barrier(array, args[2]);
 
             return PrimValue::unit();
         });
@@ -269,6 +271,95 @@ namespace luaxc {
         auto* gc_collect_identifier = runtime.push_string_pool_if_not_exists("__builtin_runtime_gc_collect");
         result.emplace_back(gc_collect_identifier, PrimValue(ValueType::Function, gc_collect));
 
+        // returns the previous percentage
+        FunctionObject* gc_set_percent = FunctionObject::create_native_function([&runtime](std::vector<PrimValue> args) -> PrimValue {
+            if (args.size() != 1) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            if (args[0].get_type() != ValueType::Int || args[0].get_inner_value<Int>() < 0) {
+                throw IRInterpreterException("GC percent must be a non-negative Int");
+            }
+
+            auto previous = runtime.get_gc().get_gc_percent();
+            runtime.get_gc().set_gc_percent(args[0].get_inner_value<Int>());
+            return PrimValue::from_i64(static_cast<Int>(previous));
+        });
+        runtime.gc_regist_no_collect(gc_set_percent);
+        auto* gc_set_percent_identifier = runtime.push_string_pool_if_not_exists("__builtin_runtime_gc_set_percent");
+        result.emplace_back(gc_set_percent_identifier, PrimValue(ValueType::Function, gc_set_percent));
+
+        // a snapshot of the collector's telemetry, durations in microseconds and sizes in bytes
+        FunctionObject* gc_stats = FunctionObject::create_native_function([&runtime](std::vector<PrimValue> args) {
+            auto guard = runtime.gc_guard();
+
+            auto stats = runtime.get_gc().dump_stats();
+            auto& telemetry = runtime.get_gc().get_telemetry();
+            auto& last = telemetry.get_last_collection();
+            auto as_int = [](size_t value) { return PrimValue::from_i64(static_cast<Int>(value)); };
+
+            std::vector<std::pair<std::string, PrimValue>> fields = {
+                    {"heapSize", as_int(stats.heap_size)},
+                    {"heapGoal", as_int(stats.heap_goal)},
+                    {"objectCount", as_int(stats.object_count)},
+                    {"minorCollections", as_int(stats.minor_collections)},
+                    {"fullCollections", as_int(stats.full_collections)},
+                    {"pauseCount", as_int(telemetry.get_pauses().get_count())},
+                    {"totalPause", as_int(telemetry.get_total_pause())},
+                    {"lastPause", as_int(stats.last_pause)},
+                    {"maxPause", as_int(stats.max_pause)},
+                    {"pauseP50", as_int(telemetry.get_pauses().get_percentile(50))},
+                    {"pauseP90", as_int(telemetry.get_pauses().get_percentile(90))},
+                    {"pauseP99", as_int(telemetry.get_pauses().get_percentile(99))},
+                    {"markedObjects", as_int(last.marked_objects)},
+                    {"markedBytes", as_int(last.marked_bytes)},
+                    {"freedObjects", as_int(last.freed_objects)},
+                    {"freedBytes", as_int(last.freed_bytes)},
+                    {"survivalRatio", PrimValue::from_f64(last.survival_ratio)},
+                    {"allocationRate", PrimValue::from_f64(last.allocation_rate)},
+            };
+
+            auto* object = runtime.gc_allocate<GCObject>();
+            auto* shape = TypeObject::any()->get_root_shape();
+            object->storage.prototype = TypeObject::any();
+            for (auto& [name, value]: fields) {
+                shape = shape->add_field(runtime.push_string_pool_if_not_exists(name), nullptr);
+                object->storage.slots.push_back(value);
+            }
+            object->storage.shape = shape;
+
+            auto result = PrimValue(ValueType::Object, object);
+            result.set_type_info(TypeObject::any());
+            return result;
+        });
+        runtime.gc_regist_no_collect(gc_stats);
+        auto* gc_stats_identifier = runtime.push_string_pool_if_not_exists("__builtin_runtime_gc_stats");
+        result.emplace_back(gc_stats_identifier, PrimValue(ValueType::Function, gc_stats));
+
+        FunctionObject* heap_profile_start = FunctionObject::create_native_function([&runtime](std::vector<PrimValue> args) {
+            runtime.start_heap_profile();
+            return PrimValue::unit();
+        });
+        runtime.gc_regist_no_collect(heap_profile_start);
+        auto* heap_profile_start_identifier = runtime.push_string_pool_if_not_exists("__builtin_runtime_heap_profile_start");
+        result.emplace_back(heap_profile_start_identifier, PrimValue(ValueType::Function, heap_profile_start));
+
+        FunctionObject* heap_profile_write = FunctionObject::create_native_function([&runtime](std::vector<PrimValue> args) {
+            if (args.size() != 1) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            if (!args[0].is_string()) {
+                throw IRInterpreterException("Heap profile path must be a String");
+            }
+
+            runtime.write_heap_profile(__LUAXC_EXTRACT_STRING_FROM_PRIM_VALUE(args[0]));
+            return PrimValue::unit();
+        });
+        runtime.gc_regist_no_collect(heap_profile_write);
+        auto* heap_profile_write_identifier = runtime.push_string_pool_if_not_exists("__builtin_runtime_heap_profile_write");
+        result.emplace_back(heap_profile_write_identifier, PrimValue(ValueType::Function, heap_profile_write));
+
         FunctionObject* runtime_abort = FunctionObject::create_native_function([&runtime](std::vector<PrimValue> args) {
             std::stringstream ss;
             if (args.size() >= 1) {
@@ -434,8 +525,7 @@ namespace luaxc {
             auto* lhs_str = (static_cast<StringObject*>(lhs.get_inner_value<GCObject*>()));
             auto* rhs_str = (static_cast<StringObject*>(rhs.get_inner_value<GCObject*>()));
 
-            auto* result = *lhs_str + *rhs_str;
-            runtime.gc_regist(result);
+            auto* result = runtime.gc_allocate<StringObject>(*lhs_str, *rhs_str);
 
             runtime.init_type_info(result, "String");
 
@@ -467,7 +557,8 @@ namespace luaxc {
                 LUAXC_GC_THROW_ERROR_EXPR("Index out of bounds");
             }
 
-            return PrimValue::from_string(std::string(1, string->c_str()[idx]));
+            auto* character = runtime.get_single_byte_string(static_cast<unsigned char>(string->view()[idx]));
+            return PrimValue(ValueType::String, (GCObject*){character});
         });
         runtime.gc_regist_no_collect(string_op_index_at);
         auto* string_op_index_at_identifier = runtime.push_string_pool_if_not_exists("opIndexAt");
@@ -485,6 +576,11 @@ namespace luaxc {
 
             auto* string = __LUAXC_EXTRACT_STRING_OBJECT(args[0]);
 
+            // literals are shared by every evaluation
+            if (!string->is_mutable()) {
+                LUAXC_GC_THROW_ERROR_EXPR("String literals are immutable, use a StringBuilder to edit characters");
+            }
+
             if (args[1].get_type() != ValueType::Int) {
                 throw IRInterpreterException("The argument index is not an int");
             }
@@ -505,7 +601,7 @@ namespace luaxc {
                 LUAXC_GC_THROW_ERROR_EXPR("The argument replacement is not a single character");
             }
 
-            string->get_data()[idx] = replacement->c_str()[0];
+            string->get_data()[idx] = replacement->view()[0];
 
             return PrimValue::unit();
         });
@@ -532,6 +628,360 @@ namespace luaxc {
         string_type_info->add_field(string_op_size_identifier, {TypeObject::function()});
         string_type_info->add_method(string_op_size_identifier, string_op_size);
 
+        auto* builder_type_info = new TypeObject("StringBuilder");
+        runtime.gc_regist_no_collect(builder_type_info);
+
+        auto as_builder = [builder_type_info](const std::vector<PrimValue>& args) {
+            if (args.empty() || args[0].get_type() != ValueType::Object ||
+                args[0].get_inner_value<GCObject*>()->storage.prototype != builder_type_info) {
+                throw IRInterpreterException("The argument self is not a string builder");
+            }
+            return static_cast<StringBuilderObject*>(args[0].get_inner_value<GCObject*>());
+        };
+
+#define __LUAXC_DECLARE_STRING_BUILDER_METHOD(method_name, fn_name)                        \
+    {                                                                                      \
+        runtime.gc_regist_no_collect(fn_name);                                             \
+        auto* _identifier = runtime.push_string_pool_if_not_exists(method_name);           \
+        builder_type_info->add_field(_identifier, {TypeObject::function()});               \
+        builder_type_info->add_method(_identifier, fn_name);                               \
+    }
+
+        FunctionObject* string_builder = FunctionObject::create_native_function([&runtime, builder_type_info](std::vector<PrimValue> args) -> PrimValue {
+            if (!args.empty()) {
+                throw IRInterpreterException("Invalid arguments count");
+            }
+
+            auto* builder = runtime.gc_allocate<StringBuilderObject>();
+            builder->storage.prototype = builder_type_info;
+
+            auto value = PrimValue(ValueType::Object, (GCObject*){builder});
+            value.set_type_info(builder_type_info);
+            return value;
+        });
+        runtime.gc_regist_no_collect(string_builder);
+        auto* string_builder_identifier = runtime.push_string_pool_if_not_exists("__builtin_strings_builder");
+        result.emplace_back(string_builder_identifier, PrimValue(ValueType::Function, string_builder));
+
+        // strings are appended as they are, other values as printed. returns the builder for chaining
+        FunctionObject* builder_append = FunctionObject::create_native_function([as_builder](std::vector<PrimValue> args) -> PrimValue {
+            auto* builder = as_builder(args);
+
+            for (size_t i = 1; i < args.size(); i++) {
+                if (args[i].is_string()) {
+                    auto* piece = __LUAXC_EXTRACT_STRING_OBJECT(args[i]);
+                    builder->append(piece->view());
+                } else {
+                    builder->append(args[i].to_string());
+                }
+            }
+            return args[0];
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("append", builder_append);
+
+        FunctionObject* builder_build = FunctionObject::create_native_function([&runtime, as_builder](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+            auto* builder = as_builder(args);
+
+            auto* string = runtime.gc_allocate<StringObject>(builder->view());
+            runtime.init_type_info(string, "String");
+            return PrimValue(ValueType::String, (GCObject*){string});
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("build", builder_build);
+
+        FunctionObject* builder_size = FunctionObject::create_native_function([as_builder](std::vector<PrimValue> args) -> PrimValue {
+            return PrimValue::from_i64(static_cast<Int>(as_builder(args)->get_length()));
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("size", builder_size);
+
+        FunctionObject* builder_clear = FunctionObject::create_native_function([as_builder](std::vector<PrimValue> args) -> PrimValue {
+            as_builder(args)->clear();
+            return PrimValue::unit();
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("clear", builder_clear);
+
+        FunctionObject* builder_index_at = FunctionObject::create_native_function([&runtime, as_builder](std::vector<PrimValue> args) -> PrimValue {
+            auto* builder = as_builder(args);
+
+            if (args.size() != 2 || args[1].get_type() != ValueType::Int) {
+                throw IRInterpreterException("The argument index is not an int");
+            }
+
+            auto idx = args[1].get_inner_value<Int>();
+            if (idx < 0 || idx >= builder->get_length()) {
+                LUAXC_GC_THROW_ERROR_EXPR("Index out of bounds");
+            }
+
+            auto* character = runtime.get_single_byte_string(static_cast<unsigned char>(builder->get_data()[idx]));
+            return PrimValue(ValueType::String, (GCObject*){character});
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("opIndexAt", builder_index_at);
+
+        FunctionObject* builder_index_assign = FunctionObject::create_native_function([as_builder](std::vector<PrimValue> args) -> PrimValue {
+            auto* builder = as_builder(args);
+
+            if (args.size() != 3 || args[1].get_type() != ValueType::Int) {
+                throw IRInterpreterException("The argument index is not an int");
+            }
+
+            auto idx = args[1].get_inner_value<Int>();
+            if (idx < 0 || idx >= builder->get_length()) {
+                LUAXC_GC_THROW_ERROR_EXPR("Index out of bounds");
+            }
+
+            if (!args[2].is_string() || __LUAXC_EXTRACT_STRING_OBJECT(args[2])->get_length() != 1) {
+                LUAXC_GC_THROW_ERROR_EXPR("The argument replacement is not a single character");
+            }
+
+            builder->get_data()[idx] = __LUAXC_EXTRACT_STRING_OBJECT(args[2])->view()[0];
+            return PrimValue::unit();
+        });
+        __LUAXC_DECLARE_STRING_BUILDER_METHOD("opIndexAssign", builder_index_assign);
+
+#undef __LUAXC_DECLARE_STRING_BUILDER_METHOD
+
+        auto* empty_string = runtime.push_string_pool_if_not_exists("");
+
+        // strings of a single character or none come from the pool
+        auto make_string = [&runtime, empty_string](std::string_view chars) -> PrimValue {
+            StringObject* string;
+            if (chars.empty()) {
+                string = empty_string;
+            } else if (chars.length() == 1) {
+                string = runtime.get_single_byte_string(static_cast<unsigned char>(chars[0]));
+            } else {
+                string = runtime.gc_allocate<StringObject>(chars);
+                runtime.init_type_info(string, "String");
+            }
+            return PrimValue(ValueType::String, (GCObject*){string});
+        };
+
+        auto make_substring = [&runtime, make_string](StringObject* source, size_t offset, size_t length) -> PrimValue {
+            if (length <= 1) {
+                return make_string(source->view().substr(offset, length));
+            }
+
+            auto* string = runtime.gc_allocate<StringObject>(*source, offset, length);
+            runtime.init_type_info(string, "String");
+            return PrimValue(ValueType::String, (GCObject*){string});
+        };
+
+        auto string_arg = [](const std::vector<PrimValue>& args, size_t index) {
+            if (!args[index].is_string()) {
+                throw IRInterpreterException("Invalid arg type, reqires strings");
+            }
+            return __LUAXC_EXTRACT_STRING_OBJECT(args[index]);
+        };
+
+        // negative positions count as 0
+        auto position_arg = [](const std::vector<PrimValue>& args, size_t index, size_t fallback) -> size_t {
+            if (index >= args.size()) {
+                return fallback;
+            }
+            if (args[index].get_type() != ValueType::Int) {
+                throw IRInterpreterException("Invalid arg type, the position is not an int");
+            }
+
+            auto position = args[index].get_inner_value<Int>();
+            return position < 0 ? 0 : static_cast<size_t>(position);
+        };
+
+        auto index_result = [](size_t index) {
+            return PrimValue::from_i64(index == string_kernels::npos ? -1 : static_cast<Int>(index));
+        };
+
+#define __LUAXC_DECLARE_STRINGS_FUNCTION(fn_name, fn)                                                 \
+    {                                                                                                 \
+        runtime.gc_regist_no_collect(fn);                                                             \
+        auto* _identifier = runtime.push_string_pool_if_not_exists("__builtin_strings_" fn_name);     \
+        result.emplace_back(_identifier, PrimValue(ValueType::Function, fn));                         \
+    }
+
+        // the first match at or after `from`, -1 if there is none
+        FunctionObject* strings_find = FunctionObject::create_native_function([=](std::vector<PrimValue> args) -> PrimValue {
+            if (args.size() != 2 && args.size() != 3) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto* string = string_arg(args, 0);
+            auto* needle = string_arg(args, 1);
+            return index_result(string_kernels::find(string->view(), needle->view(), position_arg(args, 2, 0)));
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("find", strings_find);
+
+        // the last match starting at or before `before`, -1 if there is none
+        FunctionObject* strings_rfind = FunctionObject::create_native_function([=](std::vector<PrimValue> args) -> PrimValue {
+            if (args.size() != 2 && args.size() != 3) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto* string = string_arg(args, 0);
+            auto* needle = string_arg(args, 1);
+            auto before = position_arg(args, 2, string_kernels::npos);
+            return index_result(string_kernels::rfind(string->view(), needle->view(), before));
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("rfind", strings_rfind);
+
+        // an array of the pieces between separators, an empty separator splits into characters
+        FunctionObject* strings_split = FunctionObject::create_native_function([=, &runtime](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+
+            if (args.size() != 2) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto* string = string_arg(args, 0);
+            auto chars = string->view();
+            auto separator = string_arg(args, 1)->view();
+
+            std::vector<PrimValue> pieces;
+            if (separator.empty()) {
+                for (auto c: chars) {
+                    pieces.push_back(make_string({&c, 1}));
+                }
+            } else {
+                size_t start = 0;
+                for (auto end = string_kernels::find(chars, separator); end != string_kernels::npos;
+                     end = string_kernels::find(chars, separator, start)) {
+                    pieces.push_back(make_substring(string, start, end - start));
+                    start = end + separator.length();
+                }
+                pieces.push_back(make_substring(string, start, chars.length() - start));
+            }
+
+            auto* array = runtime.gc_allocate<ArrayObject>(pieces.size(), pieces.data(), string_type_info);
+            runtime.init_type_info(array, "Array");
+            return PrimValue(ValueType::Array, (GCObject*){array});
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("split", strings_split);
+
+        // every match replaced, the contents are shared when there is none
+        FunctionObject* strings_replace = FunctionObject::create_native_function([=, &runtime](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+
+            if (args.size() != 3) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto* string = string_arg(args, 0);
+            auto chars = string->view();
+            auto pattern = string_arg(args, 1)->view();
+            auto replacement = string_arg(args, 2)->view();
+
+            if (pattern.empty()) {
+                throw IRInterpreterException("Invalid arg, the pattern to replace is empty");
+            }
+
+            auto match = string_kernels::find(chars, pattern);
+            if (match == string_kernels::npos) {
+                return make_substring(string, 0, chars.length());
+            }
+
+            std::string replaced;
+            replaced.reserve(chars.length());
+
+            size_t start = 0;
+            for (; match != string_kernels::npos; match = string_kernels::find(chars, pattern, start)) {
+                replaced.append(chars.substr(start, match - start));
+                replaced.append(replacement);
+                start = match + pattern.length();
+            }
+            replaced.append(chars.substr(start));
+
+            return make_string(replaced);
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("replace", strings_replace);
+
+        FunctionObject* strings_starts_with = FunctionObject::create_native_function([=](std::vector<PrimValue> args) -> PrimValue {
+            if (args.size() != 2) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto chars = string_arg(args, 0)->view();
+            auto prefix = string_arg(args, 1)->view();
+            return PrimValue::from_bool(chars.substr(0, prefix.length()) == prefix);
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("startsWith", strings_starts_with);
+
+        // without the ascii whitespace at both ends
+        FunctionObject* strings_trim = FunctionObject::create_native_function([=, &runtime](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+
+            if (args.size() != 1) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto* string = string_arg(args, 0);
+            auto chars = string->view();
+
+            size_t begin = 0;
+            size_t end = chars.length();
+            while (begin < end && string_kernels::is_space(chars[begin])) {
+                begin++;
+            }
+            while (end > begin && string_kernels::is_space(chars[end - 1])) {
+                end--;
+            }
+            return make_substring(string, begin, end - begin);
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("trim", strings_trim);
+
+        // ascii letters only
+        FunctionObject* strings_to_upper = FunctionObject::create_native_function([=, &runtime](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+
+            if (args.size() != 1) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            auto chars = string_arg(args, 0)->view();
+            if (chars.length() <= 1) {
+                char upper = 0;
+                string_kernels::to_upper(chars.data(), &upper, chars.length());
+                return make_string({&upper, chars.length()});
+            }
+
+            auto* upper = runtime.gc_allocate<StringObject>(chars);
+            runtime.init_type_info(upper, "String");
+            string_kernels::to_upper(upper->get_data(), upper->get_data(), upper->get_length());
+            return PrimValue(ValueType::String, (GCObject*){upper});
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("toUpper", strings_to_upper);
+
+        // the elements of an array with the separator in between, values that are not strings as printed
+        FunctionObject* strings_join = FunctionObject::create_native_function([=, &runtime](std::vector<PrimValue> args) -> PrimValue {
+            auto guard = runtime.gc_guard();
+
+            if (args.size() != 2) {
+                throw IRInterpreterException("Invalid arg size");
+            }
+
+            if (args[0].get_type() != ValueType::Array) {
+                throw IRInterpreterException("Invalid arg type, the elements are not an array");
+            }
+
+            auto* array = static_cast<ArrayObject*>(args[0].get_inner_value<GCObject*>());
+            auto separator = string_arg(args, 1)->view();
+
+            std::string joined;
+            for (size_t i = 0; i < array->get_size(); i++) {
+                if (i > 0) {
+                    joined.append(separator);
+                }
+
+                auto element = array->get_element(i);
+                if (element.is_string()) {
+                    joined.append(__LUAXC_EXTRACT_STRING_OBJECT(element)->view());
+                } else {
+                    joined.append(element.to_string());
+                }
+            }
+            return make_string(joined);
+        });
+        __LUAXC_DECLARE_STRINGS_FUNCTION("join", strings_join);
+
+#undef __LUAXC_DECLARE_STRINGS_FUNCTION
+
         return result;
     }
 }// namespace luaxc
\ No newline at end of file
@@ -159,7 +159,21 @@ namespace luaxc {
                 std::cout << "      " << "| " << name << " = " << var.second.to_string() << std::endl;
             }
 
-            if (it->variables.empty()) {
+            bool is_slot_present = false;
+            if (it->slot_names != nullptr) {
+                auto& names = *it->slot_names;
+                for (size_t slot = 0; slot < names.size(); slot++) {
+                    if (it->slot(slot).get_type() == ValueType::Unknown) {
+                        continue;
+                    }
+
+                    is_slot_present = true;
+                    std::cout << "      " << "| " << names[slot]->contained_string()
+                              << " = " << it->slot(slot).to_string() << " (slot " << slot << ")" << std::endl;
+                }
+            }
+
+            if (it->variables.empty() && !is_slot_present) {
                 std::cout << "      " << "| <empty>" << std::endl;
             }
 
@@ -172,7 +186,7 @@ namespace luaxc {
     }
 
     void ReplEnv::show_byte_code() {
-        std::cout << dump_bytecode(runtime.get_byte_code()) << std::endl;
+        std::cout << dump_bytecode(runtime.get_byte_code(), runtime.get_constant_tables()) << std::endl;
     }
 
     std::string ReplEnv::cvt_bytes_to_string(size_t bytes) {
@@ -197,7 +211,15 @@ namespace luaxc {
                   << __LUAXC_REPL_COLORS_RESET << std::endl
                   << "--  Max Heap Size: " << cvt_bytes_to_string(stats.max_heap_size) << std::endl
                   << "--  Heap Size: " << cvt_bytes_to_string(stats.heap_size) << std::endl
-                  << "--  Objects: " << stats.object_count << std::endl;
+                  << "--  Objects: " << stats.object_count << std::endl
+                  << "--  Last Pause: " << stats.last_pause << " us" << std::endl
+                  << "--  Max Pause: " << stats.max_pause << " us" << std::endl
+                  << "--  P99 Pause: " << stats.p99_pause << " us" << std::endl
+                  << "--  Total Pause: " << stats.total_pause << " us" << std::endl
+                  << "--  Heap Goal: " << cvt_bytes_to_string(stats.heap_goal) << std::endl
+                  << "--  Nursery Size: " << cvt_bytes_to_string(stats.nursery_size) << std::endl
+                  << "--  Collections: " << stats.minor_collections << " minor, "
+                  << stats.full_collections << " full" << std::endl;
     }
 
     void ReplEnv::addline(const std::string& line) {
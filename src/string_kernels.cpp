@@ -0,0 +1,345 @@
+#include "string_kernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(LUAXC_SIMD_STRINGS) && (defined(__x86_64__) || defined(_M_X64))
+#include <immintrin.h>
+// sse2 is part of x86-64
+#define __LUAXC_STRINGS_SSE2
+#if defined(__GNUC__)
+// compiled for avx2 per function, and only called when the cpu supports it
+#define __LUAXC_STRINGS_AVX2
+#define __LUAXC_STRINGS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+namespace luaxc::string_kernels {
+    namespace {
+        enum class Isa {
+            Scalar,
+            SSE2,
+            AVX2,
+        };
+
+        Isa detect_isa() {
+#if defined(__LUAXC_STRINGS_AVX2)
+            if (__builtin_cpu_supports("avx2")) {
+                return Isa::AVX2;
+            }
+#endif
+#if defined(__LUAXC_STRINGS_SSE2)
+            return Isa::SSE2;
+#else
+            return Isa::Scalar;
+#endif
+        }
+
+        Isa get_active_isa() {
+            static const Isa isa = detect_isa();
+            return isa;
+        }
+
+        [[maybe_unused]] unsigned lowest_bit(unsigned mask) {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return index;
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        [[maybe_unused]] unsigned highest_bit(unsigned mask) {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanReverse(&index, mask);
+            return index;
+#else
+            return 31 - __builtin_clz(mask);
+#endif
+        }
+
+        size_t find_byte_scalar(const char* data, size_t length, size_t from, char byte) {
+            for (size_t i = from; i < length; i++) {
+                if (data[i] == byte) {
+                    return i;
+                }
+            }
+            return npos;
+        }
+
+        // needles are at least 2 bytes long and fit into the haystack from `from` on
+        size_t find_scalar(const char* data, size_t length, const char* needle, size_t needle_length, size_t from) {
+            return std::string_view(data, length).find(std::string_view(needle, needle_length), from);
+        }
+
+        // matches starting before `end`
+        size_t rfind_scalar(const char* data, size_t length, const char* needle, size_t needle_length, size_t end) {
+            if (end == 0) {
+                return npos;
+            }
+            auto bounded = std::string_view(data, std::min(length, end - 1 + needle_length));
+            return bounded.rfind(std::string_view(needle, needle_length), end - 1);
+        }
+
+        void to_upper_scalar(const char* in, char* out, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                out[i] = in[i] >= 'a' && in[i] <= 'z' ? char(in[i] - ('a' - 'A')) : in[i];
+            }
+        }
+
+        // substrings are searched for the way Wojciech Muła describes it: blocks of positions are
+        // checked for the first and the last byte of the needle at once, and only the candidates that
+        // match both are compared in full.
+
+#if defined(__LUAXC_STRINGS_SSE2)
+        size_t find_byte_sse2(const char* data, size_t length, size_t from, char byte) {
+            auto pattern = _mm_set1_epi8(byte);
+
+            size_t i = from;
+            for (; i + 16 <= length; i += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                auto mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)));
+                if (mask != 0) {
+                    return i + lowest_bit(mask);
+                }
+            }
+            return find_byte_scalar(data, length, i, byte);
+        }
+
+        size_t find_sse2(const char* data, size_t length, const char* needle, size_t needle_length, size_t from) {
+            auto first = _mm_set1_epi8(needle[0]);
+            auto last = _mm_set1_epi8(needle[needle_length - 1]);
+
+            size_t i = from;
+            for (; i + needle_length - 1 + 16 <= length; i += 16) {
+                auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                auto block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + needle_length - 1));
+                auto mask = unsigned(_mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+
+                for (; mask != 0; mask &= mask - 1) {
+                    auto offset = lowest_bit(mask);
+                    if (std::memcmp(data + i + offset + 1, needle + 1, needle_length - 2) == 0) {
+                        return i + offset;
+                    }
+                }
+            }
+            return find_scalar(data, length, needle, needle_length, i);
+        }
+
+        size_t rfind_sse2(const char* data, size_t length, const char* needle, size_t needle_length, size_t end) {
+            auto first = _mm_set1_epi8(needle[0]);
+            auto last = _mm_set1_epi8(needle[needle_length - 1]);
+
+            for (; end >= 16; end -= 16) {
+                auto base = end - 16;
+                auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + base));
+                auto block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + base + needle_length - 1));
+                auto mask = unsigned(_mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+
+                for (; mask != 0; mask &= ~(1u << highest_bit(mask))) {
+                    auto offset = highest_bit(mask);
+                    if (needle_length < 3 || std::memcmp(data + base + offset + 1, needle + 1, needle_length - 2) == 0) {
+                        return base + offset;
+                    }
+                }
+            }
+            return rfind_scalar(data, length, needle, needle_length, end);
+        }
+
+        void to_upper_sse2(const char* in, char* out, size_t length) {
+            // bytes above 0x7f are negative, and never taken for lowercase letters
+            auto below_a = _mm_set1_epi8('a' - 1);
+            auto above_z = _mm_set1_epi8('z' + 1);
+            auto case_bit = _mm_set1_epi8('a' - 'A');
+
+            size_t i = 0;
+            for (; i + 16 <= length; i += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                auto lower = _mm_and_si128(_mm_cmpgt_epi8(block, below_a), _mm_cmplt_epi8(block, above_z));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi8(block, _mm_and_si128(lower, case_bit)));
+            }
+            to_upper_scalar(in + i, out + i, length - i);
+        }
+#endif
+
+#if defined(__LUAXC_STRINGS_AVX2)
+        __LUAXC_STRINGS_TARGET_AVX2
+        size_t find_byte_avx2(const char* data, size_t length, size_t from, char byte) {
+            auto pattern = _mm256_set1_epi8(byte);
+
+            size_t i = from;
+            for (; i + 32 <= length; i += 32) {
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                auto mask = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern)));
+                if (mask != 0) {
+                    return i + lowest_bit(mask);
+                }
+            }
+            return find_byte_sse2(data, length, i, byte);
+        }
+
+        __LUAXC_STRINGS_TARGET_AVX2
+        size_t find_avx2(const char* data, size_t length, const char* needle, size_t needle_length, size_t from) {
+            auto first = _mm256_set1_epi8(needle[0]);
+            auto last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+            size_t i = from;
+            for (; i + needle_length - 1 + 32 <= length; i += 32) {
+                auto block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                auto block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + needle_length - 1));
+                auto mask = unsigned(_mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+
+                for (; mask != 0; mask &= mask - 1) {
+                    auto offset = lowest_bit(mask);
+                    if (std::memcmp(data + i + offset + 1, needle + 1, needle_length - 2) == 0) {
+                        return i + offset;
+                    }
+                }
+            }
+            return find_sse2(data, length, needle, needle_length, i);
+        }
+
+        __LUAXC_STRINGS_TARGET_AVX2
+        size_t rfind_avx2(const char* data, size_t length, const char* needle, size_t needle_length, size_t end) {
+            auto first = _mm256_set1_epi8(needle[0]);
+            auto last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+            for (; end >= 32; end -= 32) {
+                auto base = end - 32;
+                auto block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + base));
+                auto block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + base + needle_length - 1));
+                auto mask = unsigned(_mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+
+                for (; mask != 0; mask &= ~(1u << highest_bit(mask))) {
+                    auto offset = highest_bit(mask);
+                    if (needle_length < 3 || std::memcmp(data + base + offset + 1, needle + 1, needle_length - 2) == 0) {
+                        return base + offset;
+                    }
+                }
+            }
+            return rfind_sse2(data, length, needle, needle_length, end);
+        }
+
+        __LUAXC_STRINGS_TARGET_AVX2
+        void to_upper_avx2(const char* in, char* out, size_t length) {
+            auto below_a = _mm256_set1_epi8('a' - 1);
+            auto above_z = _mm256_set1_epi8('z' + 1);
+            auto case_bit = _mm256_set1_epi8('a' - 'A');
+
+            size_t i = 0;
+            for (; i + 32 <= length; i += 32) {
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+                auto lower = _mm256_and_si256(_mm256_cmpgt_epi8(block, below_a), _mm256_cmpgt_epi8(above_z, block));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_sub_epi8(block, _mm256_and_si256(lower, case_bit)));
+            }
+            to_upper_sse2(in + i, out + i, length - i);
+        }
+#endif
+    }// namespace
+
+    size_t find_byte(std::string_view haystack, char byte, size_t from) {
+        switch (get_active_isa()) {
+#if defined(__LUAXC_STRINGS_AVX2)
+            case Isa::AVX2:
+                return find_byte_avx2(haystack.data(), haystack.length(), from, byte);
+#endif
+#if defined(__LUAXC_STRINGS_SSE2)
+            case Isa::SSE2:
+                return find_byte_sse2(haystack.data(), haystack.length(), from, byte);
+#endif
+            default:
+                return find_byte_scalar(haystack.data(), haystack.length(), from, byte);
+        }
+    }
+
+    size_t find(std::string_view haystack, std::string_view needle, size_t from) {
+        if (from > haystack.length() || needle.length() > haystack.length() - from) {
+            return npos;
+        }
+        if (needle.empty()) {
+            return from;
+        }
+        if (needle.length() == 1) {
+            return find_byte(haystack, needle[0], from);
+        }
+
+        switch (get_active_isa()) {
+#if defined(__LUAXC_STRINGS_AVX2)
+            case Isa::AVX2:
+                return find_avx2(haystack.data(), haystack.length(), needle.data(), needle.length(), from);
+#endif
+#if defined(__LUAXC_STRINGS_SSE2)
+            case Isa::SSE2:
+                return find_sse2(haystack.data(), haystack.length(), needle.data(), needle.length(), from);
+#endif
+            default:
+                return find_scalar(haystack.data(), haystack.length(), needle.data(), needle.length(), from);
+        }
+    }
+
+    size_t rfind(std::string_view haystack, std::string_view needle, size_t before) {
+        if (needle.length() > haystack.length()) {
+            return npos;
+        }
+
+        auto last = std::min(before, haystack.length() - needle.length());
+        if (needle.empty()) {
+            return last;
+        }
+
+        // a single byte is its own first and last byte, so the kernels take it too
+        switch (get_active_isa()) {
+#if defined(__LUAXC_STRINGS_AVX2)
+            case Isa::AVX2:
+                return rfind_avx2(haystack.data(), haystack.length(), needle.data(), needle.length(), last + 1);
+#endif
+#if defined(__LUAXC_STRINGS_SSE2)
+            case Isa::SSE2:
+                return rfind_sse2(haystack.data(), haystack.length(), needle.data(), needle.length(), last + 1);
+#endif
+            default:
+                return rfind_scalar(haystack.data(), haystack.length(), needle.data(), needle.length(), last + 1);
+        }
+    }
+
+    void to_upper(const char* in, char* out, size_t length) {
+        switch (get_active_isa()) {
+#if defined(__LUAXC_STRINGS_AVX2)
+            case Isa::AVX2:
+                return to_upper_avx2(in, out, length);
+#endif
+#if defined(__LUAXC_STRINGS_SSE2)
+            case Isa::SSE2:
+                return to_upper_sse2(in, out, length);
+#endif
+            default:
+                return to_upper_scalar(in, out, length);
+        }
+    }
+
+    const char* get_isa() {
+        switch (get_active_isa()) {
+            case Isa::AVX2:
+                return "avx2";
+            case Isa::SSE2:
+                return "sse2";
+            default:
+                return "scalar";
+        }
+    }
+}// namespace luaxc::string_kernels
+
+#undef __LUAXC_STRINGS_SSE2
+#undef __LUAXC_STRINGS_AVX2
+#undef __LUAXC_STRINGS_TARGET_AVX2
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+
+namespace luaxc {
+    // byte scanning behind the strings library.
+    // on x86-64 the loops compare 16 bytes at a time with SSE2, or 32 with AVX2 when the cpu has it,
+    // other targets and the last few bytes of a string take the scalar path.
+    namespace string_kernels {
+        constexpr size_t npos = std::string_view::npos;
+
+        // positions are npos when there is no match
+        size_t find_byte(std::string_view haystack, char byte, size_t from = 0);
+
+        size_t find(std::string_view haystack, std::string_view needle, size_t from = 0);
+
+        // the last match starting at or before `before`
+        size_t rfind(std::string_view haystack, std::string_view needle, size_t before = npos);
+
+        // ascii only, other bytes are copied as they are. `in` and `out` may be the same
+        void to_upper(const char* in, char* out, size_t length);
+
+        inline bool is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+        }
+
+        // the name of the kernels in use, for diagnostics
+        const char* get_isa();
+    }// namespace string_kernels
+}// namespace luaxc
@@ -136,7 +136,7 @@ namespace luaxc {
                 return "[unknown object]";
             }
         };
-        return std::visit(to_string, value);
+        return std::visit(to_string, get_value());
     }
 
     bool PrimValue::to_bool() const {
@@ -153,7 +153,7 @@ namespace luaxc {
                 LUAXC_GC_THROW_ERROR("Invalid operand type for boolean coercion");
         };
 
-        return std::visit(to_bool_impl, value);
+        return std::visit(to_bool_impl, get_value());
     }
 
     StackFrame& StackFrameRef::get_frame() {
@@ -174,6 +174,40 @@ namespace luaxc {
         pending_return = false;
 
         this->inner.frame.variables = frame.variables;
+        this->inner.frame.slots = frame.slots;
+        this->inner.frame.slot_names = frame.slot_names;
+    }
+
+    void StackFrame::bind_window(std::vector<PrimValue>* stack, size_t base, const LocalSlotNames& names) {
+        slot_names = names;
+        window = stack;
+        window_base = base;
+    }
+
+    PrimValue* StackFrame::find_variable(StringObject* identifier) {
+        return const_cast<PrimValue*>(static_cast<const StackFrame*>(this)->find_variable(identifier));
+    }
+
+    const PrimValue* StackFrame::find_variable(StringObject* identifier) const {
+        if (!variables.empty()) {
+            auto it = variables.find(identifier);
+            if (it != variables.end()) {
+                return &it->second;
+            }
+        }
+
+        if (slot_names != nullptr) {
+            // identifiers all come from the runtime string pool,
+            // so comparing the pointers is enough here.
+            auto& names = *slot_names;
+            for (size_t i = 0; i < names.size(); i++) {
+                if (names[i] == identifier && slot(i).get_type() != ValueType::Unknown) {
+                    return &slot(i);
+                }
+            }
+        }
+
+        return nullptr;
     }
 
     std::shared_ptr<StackFrameRef> StackFrame::make_ref() {
@@ -183,46 +217,58 @@ namespace luaxc {
     }
 
     void StackFrame::notify_return() {
+        if (pending_refs.empty()) {
+            return;
+        }
+
+        // the window goes away with the frame, refs keep their own copy
+        if (window) {
+            slots.assign(window->begin() + window_base, window->begin() + window_base + slot_count());
+        }
+
         for (auto& ref: pending_refs) {
             ref->notify_return(*this);
         }
     }
 
-    size_t FrozenContextObject::get_object_size() const {
-        size_t base_size = sizeof(FrozenContextObject);
-        for (auto& frame: stack_frames) {
-            base_size += frame->get_frame().variables.size() * sizeof(PrimValue);
+    size_t FrozenContextObject::get_owned_size() const {
+        size_t size = GCObject::get_owned_size() + allocated_size(stack_frames);
+        for (auto& ref: stack_frames) {
+            // frames still running live on the interpreter's stacks, returned ones are copied into the ref.
+            // refs are shared by the contexts of every closure made in the frame, each pays its part.
+            auto& frame = ref->inner.frame;
+            // make_shared puts the ref next to its two counts
+            size_t frame_size = estimated_allocation_size(sizeof(StackFrameRef) + 2 * sizeof(size_t)) +
+                                allocated_size(frame.variables) + allocated_size(frame.slots) +
+                                allocated_size(frame.pending_refs);
+            size += frame_size / std::max<long>(ref.use_count(), 1);
         }
-        return base_size;
+        return size;
     }
 
-    std::vector<GCObject*> FrozenContextObject::get_referenced_objects() const {
-        std::vector<GCObject*> referenced_objects;
-        auto base = GCObject::get_referenced_objects();
-        referenced_objects.insert(referenced_objects.end(), base.begin(), base.end());
+    void FrozenContextObject::trace(GCVisitor& visitor) const {
+        GCObject::trace(visitor);
 
         for (auto& frame: stack_frames) {
             for (auto& [identifier, value]: frame->get_frame().variables) {
-                if (value.is_gc_object()) {
-                    referenced_objects.push_back(value.get_inner_value<GCObject*>());
-                }
+                visitor.visit_value(value);
             }
-        }
 
-        // this object also references the next object
-        if (next != nullptr) {
-            referenced_objects.push_back(this->next);
+            auto& captured = frame->get_frame();
+            for (size_t i = 0; i < captured.slot_count(); i++) {
+                visitor.visit_value(captured.slot(i));
+            }
         }
 
-        return referenced_objects;
+        // this object also references the next object
+        visitor.visit(next);
     }
 
     std::optional<PrimValue> FrozenContextObject::query(StringObject* identifier) const {
         for (auto frame_ref = stack_frames.rbegin(); frame_ref != stack_frames.rend(); ++frame_ref) {
             auto& frame = (*frame_ref)->get_frame();
-            auto it = frame.variables.find(identifier);
-            if (it != frame.variables.end()) {
-                return it->second;
+            if (auto* value = frame.find_variable(identifier)) {
+                return *value;
             }
         }
 
@@ -262,74 +308,157 @@ namespace luaxc {
         }
     }
 
-    std::vector<GCObject*> GCObject::get_referenced_objects() const {
-        std::vector<GCObject*> referenced_objects;
-        for (auto& [_, object]: storage.fields) {
-            if (object.is_gc_object()) {
-                referenced_objects.push_back(object.get_inner_value<GCObject*>());
+    Shape::Shape(TypeObject* owner, Shape* parent) : owner(owner) {
+        static uint64_t next_id = 0;
+        id = next_id++;
+
+        if (parent) {
+            names = parent->names;
+            types = parent->types;
+            offsets = parent->offsets;
+        }
+    }
+
+    std::optional<size_t> Shape::lookup(StringObject* name) const {
+        auto it = offsets.find(name);
+        if (it == offsets.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void Shape::define_field(StringObject* name, TypeObject* type) {
+        offsets.emplace(name, names.size());
+        names.push_back(name);
+        types.push_back(type);
+    }
+
+    Shape* Shape::add_field(StringObject* name, TypeObject* type) {
+        if (auto it = transitions.find(name); it != transitions.end()) {
+            return it->second.get();
+        }
+
+        auto child = std::make_unique<Shape>(owner, this);
+        child->define_field(name, type);
+
+        auto* child_ptr = child.get();
+        transitions.emplace(name, std::move(child));
+        return child_ptr;
+    }
+
+    PrimValue* GCObject::find_field(StringObject* name) {
+        if (storage.shape) {
+            if (auto offset = storage.shape->lookup(name)) {
+                return &storage.slots[*offset];
             }
         }
-        return referenced_objects;
+
+        auto it = storage.fields.find(name);
+        if (it == storage.fields.end()) {
+            return nullptr;
+        }
+        return &it->second;
     }
 
-    size_t GCObject::get_object_size() const {
-        size_t size = sizeof(GCObject);
-        size += storage.fields.size() * sizeof(PrimValue);
-        return size;
+    FunctionObject* GCObject::find_method(StringObject* name) const {
+        if (!storage.prototype) {
+            return nullptr;
+        }
+        return storage.prototype->find_method(name);
     }
 
-    std::vector<GCObject*> ArrayObject::get_referenced_objects() const {
-        std::vector<GCObject*> referenced_objects;
-        auto base = GCObject::get_referenced_objects();
-        referenced_objects.insert(referenced_objects.end(), base.begin(), base.end());
+    std::optional<PrimValue> GCObject::find_member(StringObject* name) {
+        if (auto* field = find_field(name)) {
+            return *field;
+        }
+
+        if (auto* method = find_method(name)) {
+            return PrimValue(ValueType::Function, method);
+        }
+        return std::nullopt;
+    }
+
+    void GCObject::trace(GCVisitor& visitor) const {
+        for (auto& [_, object]: storage.fields) {
+            visitor.visit_value(object);
+        }
+
+        for (auto& object: storage.slots) {
+            visitor.visit_value(object);
+        }
+
+        // the shape is owned by its type, keep it alive
+        if (storage.shape) {
+            visitor.visit(storage.shape->get_owner());
+        }
+
+        visitor.visit(storage.prototype);
+    }
+
+    size_t GCObject::get_owned_size() const {
+        return allocated_size(storage.fields) + allocated_size(storage.slots);
+    }
+
+    void ArrayObject::trace(GCVisitor& visitor) const {
+        GCObject::trace(visitor);
 
         for (size_t i = 0; i < size; i++) {
-            if (data[i].is_gc_object()) {
-                referenced_objects.push_back(data[i].get_inner_value<GCObject*>());
-            }
+            visitor.visit_value(data[i]);
         }
-        return referenced_objects;
     }
 
-    size_t ArrayObject::get_object_size() const {
-        size_t size = sizeof(ArrayObject);
-        size += this->size * sizeof(PrimValue);
-        return size;
+    size_t ArrayObject::get_owned_size() const {
+        // new[] only puts a cookie in front of elements with a destructor
+        static_assert(std::is_trivially_destructible_v<PrimValue>);
+        return GCObject::get_owned_size() + allocated_size(data, size * sizeof(PrimValue));
+    }
+
+    void FunctionObject::trace(GCVisitor& visitor) const {
+        GCObject::trace(visitor);
+
+        // gc will look into the ctx
+        visitor.visit(ctx);
+
+        for (auto* upvalue: upvalues) {
+            visitor.visit(upvalue);
+        }
     }
 
-    std::vector<GCObject*> FunctionObject::get_referenced_objects() const {
-        std::vector<GCObject*> referenced_objects;
-        auto base = GCObject::get_referenced_objects();
-        referenced_objects.insert(referenced_objects.end(), base.begin(), base.end());
+    void UpvalueObject::trace(GCVisitor& visitor) const {
+        // an open upvalue points into the value stack, which is a root already
+        if (!is_open()) {
+            visitor.visit_value(closed);
+        }
+    }
 
-        if (this->ctx != nullptr) {
-            referenced_objects.push_back(this->ctx);
-            // gc will look into the ctx
-            // referenced_objects = this->ctx->get_referenced_objects();
+    Shape* TypeObject::get_root_shape() {
+        if (!root_shape) {
+            root_shape = std::make_unique<Shape>(this, nullptr);
+            for (auto& [name, field]: fields) {
+                // methods are resolved through the type, objects only carry data
+                if (has_method(name) || has_static_method(name)) {
+                    continue;
+                }
+                root_shape->define_field(name, field.type_ptr);
+            }
         }
-        return referenced_objects;
+        return root_shape.get();
     }
 
-    std::vector<GCObject*> TypeObject::get_referenced_objects() const {
-        std::vector<GCObject*> referenced_objects;
-        auto base = GCObject::get_referenced_objects();
-        referenced_objects.insert(referenced_objects.end(), base.begin(), base.end());
+    void TypeObject::trace(GCVisitor& visitor) const {
+        GCObject::trace(visitor);
 
         for (auto& [name, type_info]: fields) {
-            if (type_info.type_ptr) {
-                referenced_objects.push_back(type_info.type_ptr);
-            }
+            visitor.visit(type_info.type_ptr);
         }
 
         for (auto& [name, method]: member_funcs) {
-            referenced_objects.push_back(method);
+            visitor.visit(method);
         }
 
         for (auto& [name, method]: static_funcs) {
-            referenced_objects.push_back(method);
+            visitor.visit(method);
         }
-
-        return referenced_objects;
     }
 
     namespace detail {
@@ -1,14 +1,22 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <new>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <variant>
+#include <vector>
+
+#include "alloc_size.hpp"
 
 
 namespace luaxc {
@@ -31,7 +39,7 @@ namespace luaxc {
 #define LUAXC_GC_THROW_ERROR_EXPR(message) throw error::GCError(message)
     }// namespace error
 
-    enum class ValueType {
+    enum class ValueType : uint8_t {
         Boolean,
         Int,
         Float,
@@ -64,10 +72,12 @@ namespace luaxc {
 
     using StringObject = BasicStringObject<char>;
 
+    // keys of these maps are symbols from the string pool, which cache their hash.
+    // there is one symbol per name in the process, so keys are equal only when they are the same object.
     template<typename Encoding>
     struct BasicStringObjectPtrHash {
         size_t operator()(BasicStringObject<Encoding>* string) const {
-            return std::hash<std::basic_string<Encoding>>{}(string->contained_string());
+            return string->get_hash();
         }
     };
 
@@ -76,7 +86,7 @@ namespace luaxc {
     template<typename Encoding>
     struct BasicStringObjectPtrCompareEq {
         bool operator()(BasicStringObject<Encoding>* lhs, BasicStringObject<Encoding>* rhs) const {
-            return lhs->contained_string() == rhs->contained_string();
+            return lhs == rhs;
         }
     };
 
@@ -85,54 +95,158 @@ namespace luaxc {
     template<typename T>
     using StringObjectKeyMap = std::unordered_map<StringObject*, T, StringObjectPtrHash, StringObjectPtrCompareEq>;
 
+    // hidden class shared by objects instantiated from the same type.
+    // each shape maps field names to fixed slot offsets, adding a field
+    // to an object moves it along a transition to a child shape.
+    class Shape {
+    public:
+        Shape(TypeObject* owner, Shape* parent);
+
+        uint64_t get_id() const { return id; }
+
+        TypeObject* get_owner() const { return owner; }
+
+        size_t get_slot_count() const { return names.size(); }
+
+        StringObject* get_slot_name(size_t offset) const { return names[offset]; }
+
+        // null when the slot is not typed by the owner, i.e. no coercion on store
+        TypeObject* get_slot_type(size_t offset) const { return types[offset]; }
+
+        std::optional<size_t> lookup(StringObject* name) const;
+
+        // appends in place, only valid while the shape is not shared yet
+        void define_field(StringObject* name, TypeObject* type);
+
+        // returns the (cached) transition to the shape with one more field
+        Shape* add_field(StringObject* name, TypeObject* type);
+
+    private:
+        uint64_t id;
+        TypeObject* owner;
+        std::vector<StringObject*> names;
+        std::vector<TypeObject*> types;
+        StringObjectKeyMap<size_t> offsets;
+        StringObjectKeyMap<std::unique_ptr<Shape>> transitions;
+    };
+
+    // receives the references of an object while the collector traces it
+    class GCVisitor {
+    public:
+        virtual void visit(GCObject* object) = 0;
+
+        void visit_value(const PrimValue& value);
+
+    protected:
+        ~GCVisitor() = default;
+    };
+
     class GCObject {
     public:
         bool marked = false;
 
         bool no_collect = false;
 
+        // set for objects in the collector's heap pages, which keep their mark bit in the page
+        bool in_heap = false;
+
+        // charged to the collector when registered and given back when swept.
+        // the object may grow in between, it is measured again whenever a collection marks it.
+        size_t accounted_size = 0;
+
+        // null falls back to the default type info of the value tag
+        TypeObject* type_info = nullptr;
+
         virtual std::string to_string() const { return "[gc object]"; };
 
         virtual ~GCObject() = default;
 
-        virtual std::vector<GCObject*> get_referenced_objects() const;
+        // hands every object referenced by this one to the visitor, children may be null
+        virtual void trace(GCVisitor& visitor) const;
 
-        virtual size_t get_object_size() const;
+        // memory owned by the object outside of its own allocation, as spent by the allocator.
+        // memory shared with other objects is not owned.
+        virtual size_t get_owned_size() const;
 
         struct {
             StringObjectKeyMap<PrimValue> fields;
+
+            // objects created from a type keep their fields in shape-laid slots
+            Shape* shape = nullptr;
+            std::vector<PrimValue> slots;
+
+            // methods are not copied into objects, they are looked up here
+            TypeObject* prototype = nullptr;
         } storage;
+
+        // data fields only
+        PrimValue* find_field(StringObject* name);
+
+        FunctionObject* find_method(StringObject* name) const;
+
+        // data fields first, then methods of the prototype
+        std::optional<PrimValue> find_member(StringObject* name);
     };
 
     template<typename Encoding>
     class BasicStringObject : public GCObject {
     public:
-        explicit BasicStringObject<Encoding>(const std::basic_string<Encoding>& str) {
-            length = str.length();// no null terminator.
-            this->data = static_cast<Encoding*>(std::malloc(sizeof(Encoding) * (length + 1)));
-            std::memcpy(this->data, str.data(), length + 1);
-
-            this->data[length] = Encoding(0);
+        explicit BasicStringObject<Encoding>(std::basic_string_view<Encoding> str) : length(str.length()) {
+            std::memcpy(reserve(), str.data(), length * sizeof(Encoding));
         }
 
-        BasicStringObject<Encoding> operator=(const BasicStringObject<Encoding>& other) {
-            length = other.length;
-            this->data = static_cast<Encoding*>(std::malloc(sizeof(Encoding) * (length + 1)));
-            std::memcpy(this->data, other.data, length + 1);
+        explicit BasicStringObject<Encoding>(const std::basic_string<Encoding>& str)
+            : BasicStringObject<Encoding>(std::basic_string_view<Encoding>(str)) {}
+
+        // concatenation. long results refer to both operands as a rope, and are flattened once their
+        // characters are needed, so building a string piece by piece stays linear.
+        BasicStringObject<Encoding>(const BasicStringObject<Encoding>& lhs, const BasicStringObject<Encoding>& rhs) {
+            length = lhs.length + rhs.length;
+
+            if (length < min_rope_length) {
+                auto* chars = reserve();
+                lhs.copy_chars(chars);
+                rhs.copy_chars(chars + lhs.length);
+            } else {
+                rep = Rep::make_concat(lhs.share(), rhs.share(), length);
+                data = nullptr;
+            }
+        }
 
-            this->data[length] = Encoding(0);
+        // shares the contents until either string is written to, short strings are copied
+        BasicStringObject<Encoding>(const BasicStringObject<Encoding>& other)
+            : GCObject(other), length(other.length) {
+            if (other.rep != nullptr) {
+                rep = other.rep->retain();
+                data = other.data;
+            } else {
+                std::memcpy(inline_chars, other.inline_chars, sizeof(inline_chars));
+            }
+        }
 
-            return *this;
+        // `length` characters of `source` from `offset` on. long substrings share the contents of the source
+        BasicStringObject<Encoding>(const BasicStringObject<Encoding>& source, size_t offset, size_t length)
+            : length(length) {
+            auto chars = source.view().substr(offset, length);
+            if (length >= min_rope_length) {
+                rep = source.rep->retain();
+                data = const_cast<Encoding*>(chars.data());
+            } else {
+                std::memcpy(reserve(), chars.data(), length * sizeof(Encoding));
+            }
         }
 
+        BasicStringObject<Encoding>& operator=(const BasicStringObject<Encoding>& other) = delete;
+
         ~BasicStringObject<Encoding>() {
-            length = 0;
-            std::free(this->data);
+            if (rep != nullptr) {
+                Rep::release(rep);
+            }
         }
 
         bool operator==(const BasicStringObject<Encoding>& other) const {
             if (length != other.length) return false;
-            return std::memcmp(this->data, other.data, length) == 0;
+            return (rep != nullptr && rep == other.rep && data == other.data) || view() == other.view();
         }
 
         bool operator!=(const BasicStringObject<Encoding>& other) const {
@@ -140,56 +254,273 @@ namespace luaxc {
         }
 
         BasicStringObject<Encoding>* operator+(const BasicStringObject<Encoding>& other) const {
-            auto* output = new BasicStringObject<Encoding>;
-            output->length = this->length + other.length;
-
-            output->data = new Encoding[output->length + 1];
-            std::memcpy(output->data, this->data, this->length);
-            std::memcpy(output->data + this->length, other.data, other.length);
-            output->data[output->length] = Encoding(0);
+            return new BasicStringObject<Encoding>(*this, other);
+        }
 
-            return output;
+        // flattens a rope
+        std::basic_string_view<Encoding> view() const {
+            flatten();
+            return {data, length};
         }
 
-        const Encoding* c_str() const { return static_cast<const char*>(data); }
+        // like view, and copies a substring that does not reach the end of the shared contents,
+        // as it is not terminated
+        const Encoding* c_str() const {
+            flatten();
+            if (rep != nullptr && data + length != rep->chars() + rep->length) {
+                auto* leaf = Rep::make_leaf(data, length);
+                Rep::release(rep);
+                rep = leaf;
+                data = leaf->chars();
+            }
+            return data;
+        }
 
-        std::string contained_string() const { return std::basic_string<Encoding>(data, length); }
+        std::basic_string<Encoding> contained_string() const { return std::basic_string<Encoding>(view()); }
 
         static BasicStringObject<Encoding>* from_string(const std::basic_string<Encoding>& str) {
             return new BasicStringObject<Encoding>(str);
         }
 
         std::string to_string() const override {
-            return std::string(c_str());
+            return contained_string();
         }
 
         size_t get_length() const { return this->length; }
 
-        Encoding* get_data() { return this->data; }
+        bool is_rope() const { return data == nullptr; }
+
+        // for writing, the contents are copied first if they are shared
+        Encoding* get_data() {
+            assert(is_mutable());
+            flatten();
+            if (rep != nullptr && rep->refs.load(std::memory_order_relaxed) > 1) {
+                auto* copy = Rep::make_leaf(data, length);
+                Rep::release(rep);
+                rep = copy;
+                data = rep->chars();
+            }
+            return data;
+        }
 
-        size_t get_object_size() const override { return sizeof(BasicStringObject<Encoding>) + length * sizeof(Encoding); }
+        // interned strings become symbols, they cache their hash and are never changed again,
+        // since every literal with the same contents evaluates to the same symbol.
+        // strings made at runtime are not symbols.
+        void make_symbol() { symbol_hash = compute_hash(); }
+
+        bool is_symbol() const { return symbol_hash != 0; }
+
+        bool is_mutable() const { return !is_symbol(); }
+
+        size_t get_hash() const { return is_symbol() ? symbol_hash : compute_hash(); }
+
+        // shared contents are split between their owners, a rope is charged for the characters it stands for
+        size_t get_owned_size() const override {
+            if (rep == nullptr) {
+                return GCObject::get_owned_size();
+            }
+
+            auto size = rep->is_leaf()
+                                ? allocated_size(rep, sizeof(Rep) + (rep->length + 1) * sizeof(Encoding))
+                                : allocated_size(rep, sizeof(Rep)) + length * sizeof(Encoding);
+            return GCObject::get_owned_size() + size / rep->refs.load(std::memory_order_relaxed);
+        }
 
     private:
+        static constexpr size_t min_rope_length = 64;
+
+        // strings up to this length keep their characters inside the object
+        static constexpr size_t inline_capacity = 16 / sizeof(Encoding) - 1;
+        static_assert(inline_capacity < min_rope_length);
+
+        // the contents of longer strings, reference counted since they are shared by copies and ropes.
+        // a leaf keeps its characters right after the header. a concatenation refers to the contents of
+        // both operands, which are never written to again, since writes copy shared contents.
+        // counts are atomic because the collector may sweep from several threads.
+        struct Rep {
+            std::atomic<size_t> refs{1};
+            size_t length = 0;
+            Rep* left = nullptr;
+            Rep* right = nullptr;
+
+            bool is_leaf() const { return left == nullptr; }
+
+            Encoding* chars() { return reinterpret_cast<Encoding*>(this + 1); }
+
+            const Encoding* chars() const { return reinterpret_cast<const Encoding*>(this + 1); }
+
+            Rep* retain() {
+                refs.fetch_add(1, std::memory_order_relaxed);
+                return this;
+            }
+
+            // null chars leaves the characters uninitialized
+            static Rep* make_leaf(const Encoding* chars, size_t length) {
+                void* block = std::malloc(sizeof(Rep) + (length + 1) * sizeof(Encoding));
+                if (block == nullptr) {
+                    throw std::bad_alloc();
+                }
+
+                auto* rep = new (block) Rep();
+                rep->length = length;
+                if (chars != nullptr) {
+                    std::memcpy(rep->chars(), chars, length * sizeof(Encoding));
+                }
+                rep->chars()[length] = Encoding(0);
+                return rep;
+            }
+
+            // takes over a reference to both children
+            static Rep* make_concat(Rep* left, Rep* right, size_t length) {
+                void* block = std::malloc(sizeof(Rep));
+                if (block == nullptr) {
+                    throw std::bad_alloc();
+                }
+
+                auto* rep = new (block) Rep();
+                rep->length = length;
+                rep->left = left;
+                rep->right = right;
+                return rep;
+            }
+
+            // ropes may be deeper than the native stack allows, they are walked with a stack of their own
+            static void copy_chars(const Rep* rep, Encoding* out) {
+                if (rep->is_leaf()) {
+                    std::memcpy(out, rep->chars(), rep->length * sizeof(Encoding));
+                    return;
+                }
+
+                std::vector<const Rep*> pending{rep};
+                while (!pending.empty()) {
+                    auto* node = pending.back();
+                    pending.pop_back();
+
+                    if (node->is_leaf()) {
+                        std::memcpy(out, node->chars(), node->length * sizeof(Encoding));
+                        out += node->length;
+                    } else {
+                        pending.push_back(node->right);
+                        pending.push_back(node->left);
+                    }
+                }
+            }
+
+            static void release(Rep* rep) {
+                std::vector<Rep*> pending;
+                while (rep != nullptr) {
+                    Rep* next = nullptr;
+                    if (rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        if (!rep->is_leaf()) {
+                            pending.push_back(rep->right);
+                            next = rep->left;
+                        }
+                        rep->~Rep();
+                        std::free(rep);
+                    }
+
+                    if (next == nullptr && !pending.empty()) {
+                        next = pending.back();
+                        pending.pop_back();
+                    }
+                    rep = next;
+                }
+            }
+        };
+
         BasicStringObject() = default;
 
-        Encoding* data = nullptr;
+        // room for `length` characters, the terminator is already in place
+        Encoding* reserve() {
+            if (length > inline_capacity) {
+                rep = Rep::make_leaf(nullptr, length);
+                data = rep->chars();
+            }
+            data[length] = Encoding(0);
+            return data;
+        }
+
+        void copy_chars(Encoding* out) const {
+            if (data != nullptr) {
+                std::memcpy(out, data, length * sizeof(Encoding));
+            } else {
+                Rep::copy_chars(rep, out);
+            }
+        }
+
+        // a reference to the contents for a rope, short strings and substrings are copied into a leaf
+        Rep* share() const {
+            auto whole = rep != nullptr && (data == nullptr || (data == rep->chars() && length == rep->length));
+            return whole ? rep->retain() : Rep::make_leaf(data, length);
+        }
+
+        void flatten() const {
+            if (data != nullptr) {
+                return;
+            }
+
+            auto* leaf = Rep::make_leaf(nullptr, length);
+            Rep::copy_chars(rep, leaf->chars());
+            Rep::release(rep);
+            rep = leaf;
+            data = leaf->chars();
+        }
+
+        // never 0, which marks strings that are not symbols
+        size_t compute_hash() const {
+            return std::hash<std::basic_string_view<Encoding>>{}(view()) | 1;
+        }
+
+        // ropes are flattened in place by readers. strings without a rep are inline
+        mutable Rep* rep = nullptr;
+        mutable Encoding* data = inline_chars;
         size_t length = 0;
+
+        size_t symbol_hash = 0;
+
+        Encoding inline_chars[inline_capacity + 1] = {};
     };
 
     struct StackFrameRef;
 
+    using LocalSlotNames = std::shared_ptr<const std::vector<StringObject*>>;
+
     struct StackFrame {
         StringObjectKeyMap<PrimValue> variables;
         size_t return_addr;
         bool allow_upward_propagation = false;
         bool force_pop_return_value = false;
 
+        // slot-resolved locals of a function frame.
+        // a slot holding an unknown value is not yet declared,
+        // and is invisible to name-based lookups.
+        // while the frame is active, the slots are a window over the interpreter's
+        // value stack, starting with the arguments pushed by the caller.
+        // frames captured by closures copy the window into `slots` on return.
+        std::vector<PrimValue>* window = nullptr;
+        size_t window_base = 0;
+        FunctionObject* function = nullptr;
+        std::vector<PrimValue> slots;
+        LocalSlotNames slot_names = nullptr;
+
         std::vector<std::shared_ptr<StackFrameRef>> pending_refs;
 
         std::shared_ptr<StackFrameRef> make_ref();
 
         void notify_return();
 
+        void bind_window(std::vector<PrimValue>* stack, size_t base, const LocalSlotNames& names);
+
+        PrimValue& slot(size_t index) { return window ? (*window)[window_base + index] : slots[index]; }
+
+        const PrimValue& slot(size_t index) const { return const_cast<StackFrame*>(this)->slot(index); }
+
+        size_t slot_count() const { return slot_names ? slot_names->size() : 0; }
+
+        PrimValue* find_variable(StringObject* identifier);
+
+        const PrimValue* find_variable(StringObject* identifier) const;
+
         explicit StackFrame(size_t return_addr) : return_addr(return_addr) {};
         StackFrame(size_t return_addr, bool allow_propagation, bool force_pop_return_value = false)
             : return_addr(return_addr),
@@ -267,6 +598,8 @@ namespace luaxc {
             return "[type object]";
         }
 
+        const std::string& get_type_name() const { return type_name; }
+
         LUAXC_GC_VALUE_DECLARE_STATIC_TYPE_INFO(any, "Any")
         LUAXC_GC_VALUE_DECLARE_STATIC_TYPE_INFO(int_, "Int")
         LUAXC_GC_VALUE_DECLARE_STATIC_TYPE_INFO(float_, "Float")
@@ -319,21 +652,32 @@ namespace luaxc {
 
         bool has_method(StringObject* name) { return member_funcs.find(name) != member_funcs.end(); }
 
+        FunctionObject* find_method(StringObject* name) const {
+            auto it = member_funcs.find(name);
+            return it == member_funcs.end() ? nullptr : it->second;
+        }
+
         bool has_static_method(StringObject* name) { return static_funcs.find(name) != static_funcs.end(); }
 
         static TypeObject* create(const std::string& type_name) { return new TypeObject(type_name); }
 
         static TypeObject* create() { return new TypeObject(); }
 
-        std::vector<GCObject*> get_referenced_objects() const override;
+        void trace(GCVisitor& visitor) const override;
+
+        // built on first instantiation, types are sealed by then.
+        Shape* get_root_shape();
 
     private:
         std::string type_name;
+        std::unique_ptr<Shape> root_shape;
         StringObjectKeyMap<TypeField> fields;
         StringObjectKeyMap<FunctionObject*> member_funcs;
         StringObjectKeyMap<FunctionObject*> static_funcs;
     };
 
+    // a tagged 16-byte value. the tag alone decides the type info of primitives,
+    // heap objects carry their own type info (see GCObject::type_info).
     class PrimValue {
     public:
         using Value = std::variant<
@@ -346,34 +690,55 @@ namespace luaxc {
                 UnitObject>;
 
         PrimValue() : type(ValueType::Unknown) {
-            type_info = TypeObject::any();
+            payload.i = 0;
         }
 
-        explicit PrimValue(ValueType type) : type(type), value(std::monostate()) {
-            type_info = select_value_type_info(type);
+        explicit PrimValue(ValueType type) : type(type) {
+            payload.i = 0;
         }
 
-        PrimValue(ValueType type, Value value) : type(type), value(std::move(value)) {
-            type_info = select_value_type_info(type);
+        PrimValue(ValueType type, const Value& value) : type(type) {
+            payload.i = 0;
+            if (auto* b = std::get_if<Bool>(&value)) {
+                payload.b = *b;
+            } else if (auto* i = std::get_if<Int>(&value)) {
+                payload.i = *i;
+            } else if (auto* f = std::get_if<Float>(&value)) {
+                payload.f = *f;
+            } else if (auto* gc = std::get_if<GCObject*>(&value)) {
+                payload.gc = *gc;
+            }
         }
 
         static PrimValue from_string(const std::string& str) { return PrimValue(ValueType::String, StringObject::from_string(str)); };
 
-        static PrimValue from_i32(int32_t i) { return PrimValue(ValueType::Int, i); }
+        static PrimValue from_i32(int32_t i) { return from_i64(i); }
 
-        static PrimValue from_i64(int64_t i) { return PrimValue(ValueType::Int, i); }
+        static PrimValue from_i64(int64_t i) {
+            PrimValue value(ValueType::Int);
+            value.payload.i = i;
+            return value;
+        }
 
-        static PrimValue from_f32(float f) { return PrimValue(ValueType::Float, f); }
+        static PrimValue from_f32(float f) { return from_f64(f); }
 
-        static PrimValue from_f64(double f) { return PrimValue(ValueType::Float, f); }
+        static PrimValue from_f64(double f) {
+            PrimValue value(ValueType::Float);
+            value.payload.f = f;
+            return value;
+        }
 
-        static PrimValue from_bool(bool b) { return PrimValue(ValueType::Boolean, b); }
+        static PrimValue from_bool(bool b) {
+            PrimValue value(ValueType::Boolean);
+            value.payload.b = b;
+            return value;
+        }
 
-        static PrimValue null() { return PrimValue(ValueType::Null, NullObject()); }
+        static PrimValue null() { return PrimValue(ValueType::Null); }
 
-        static PrimValue unit() { return PrimValue(ValueType::Unit, UnitObject()); }
+        static PrimValue unit() { return PrimValue(ValueType::Unit); }
 
-        static PrimValue never() { return PrimValue(ValueType::Never, std::monostate()); }
+        static PrimValue never() { return PrimValue(ValueType::Never); }
 
         bool is_null() const { return type == ValueType::Null; }
 
@@ -391,14 +756,9 @@ namespace luaxc {
 
         bool is_boolean() const { return type == ValueType::Boolean; }
 
+        // heap types are laid out contiguously in ValueType
         bool is_gc_object() const {
-            static std::unordered_set<ValueType> types = {
-                    ValueType::Type, ValueType::Rule,
-                    ValueType::String, ValueType::Function,
-                    ValueType::Array, ValueType::Object,
-                    ValueType::Module};
-
-            return types.find(type) != types.end();
+            return type >= ValueType::String && type <= ValueType::Rule;
         }
 
         std::string to_string() const;
@@ -407,31 +767,101 @@ namespace luaxc {
 
         ValueType get_type() const { return type; }
 
-        Value get_value() const { return value; }
-
-        const Value& get_value_ref() const { return value; }
+        Value get_value() const {
+            switch (type) {
+                case ValueType::Boolean:
+                    return payload.b;
+                case ValueType::Int:
+                    return payload.i;
+                case ValueType::Float:
+                    return payload.f;
+                case ValueType::Null:
+                    return NullObject();
+                case ValueType::Unit:
+                    return UnitObject();
+                default:
+                    if (is_gc_object()) {
+                        return payload.gc;
+                    }
+                    return std::monostate();
+            }
+        }
 
         template<typename T>
-        T get_inner_value() const { return std::get<T>(value); }
+        T get_inner_value() const {
+            if (!holds_alternative<T>()) {
+                LUAXC_GC_THROW_ERROR("Value does not hold the requested type");
+            }
+
+            if constexpr (std::is_same_v<T, Bool>) {
+                return payload.b;
+            } else if constexpr (std::is_same_v<T, Int>) {
+                return payload.i;
+            } else if constexpr (std::is_same_v<T, Float>) {
+                return payload.f;
+            } else if constexpr (std::is_same_v<T, GCObject*>) {
+                return payload.gc;
+            } else {
+                return T();
+            }
+        }
 
         template<typename T>
-        bool holds_alternative() const { return std::holds_alternative<T>(value); }
+        bool holds_alternative() const {
+            if constexpr (std::is_same_v<T, Bool>) {
+                return type == ValueType::Boolean;
+            } else if constexpr (std::is_same_v<T, Int>) {
+                return type == ValueType::Int;
+            } else if constexpr (std::is_same_v<T, Float>) {
+                return type == ValueType::Float;
+            } else if constexpr (std::is_same_v<T, GCObject*>) {
+                return is_gc_object();
+            } else if constexpr (std::is_same_v<T, NullObject>) {
+                return type == ValueType::Null;
+            } else if constexpr (std::is_same_v<T, UnitObject>) {
+                return type == ValueType::Unit;
+            } else {
+                return type == ValueType::Never || type == ValueType::Unknown;
+            }
+        }
 
         bool operator==(const PrimValue& other) const;
 
-        void set_type_info(TypeObject* info) { type_info = info; }
+        // primitives take their type info from the tag, only heap objects can be retyped
+        void set_type_info(TypeObject* info) {
+            if (is_gc_object() && payload.gc) {
+                payload.gc->type_info = info;
+            }
+        }
 
-        TypeObject* get_type_info() const { return type_info; }
+        TypeObject* get_type_info() const {
+            if (is_gc_object() && payload.gc && payload.gc->type_info) {
+                return payload.gc->type_info;
+            }
+            return select_value_type_info(type);
+        }
 
     private:
-        ValueType type;
-        Value value;
+        union {
+            Bool b;
+            Int i;
+            Float f;
+            GCObject* gc;
+        } payload;
 
-        TypeObject* type_info;
+        ValueType type;
 
         static TypeObject* select_value_type_info(ValueType type);
     };
 
+    static_assert(sizeof(PrimValue) == 16, "PrimValue is expected to be a 16-byte tagged value");
+
+    inline void GCVisitor::visit_value(const PrimValue& value) {
+        if (value.is_gc_object()) {
+            visit(value.get_inner_value<GCObject*>());
+        }
+    }
+
     inline PrimValue default_value(TypeObject* type_info) {
         if (type_info == TypeObject::bool_()) {
             return PrimValue::from_bool(false);
@@ -452,9 +882,9 @@ namespace luaxc {
 
         FrozenContextObject() = default;
 
-        size_t get_object_size() const override;
+        size_t get_owned_size() const override;
 
-        std::vector<GCObject*> get_referenced_objects() const override;
+        void trace(GCVisitor& visitor) const override;
 
         std::optional<PrimValue> query(StringObject* identifier) const;
 
@@ -470,10 +900,46 @@ namespace luaxc {
         FrozenContextObject* next = nullptr;
     };
 
+    // a variable captured by a closure.
+    // open while the declaring frame is live, it then refers to the frame's slot on the value stack.
+    // closed when that frame returns, it then keeps its own copy of the value.
+    class UpvalueObject : public GCObject {
+    public:
+        UpvalueObject(StringObject* name, std::vector<PrimValue>* stack, size_t index)
+            : name(name), stack(stack), index(index) {}
+
+        std::string to_string() const override { return "[upvalue]"; }
+
+        StringObject* get_name() const { return name; }
+
+        bool is_open() const { return stack != nullptr; }
+
+        size_t get_stack_index() const { return index; }
+
+        const PrimValue& get() const { return is_open() ? (*stack)[index] : closed; }
+
+        void close() {
+            closed = (*stack)[index];
+            stack = nullptr;
+        }
+
+        void trace(GCVisitor& visitor) const override;
+
+    private:
+        StringObject* name;
+        std::vector<PrimValue>* stack;
+        size_t index;
+        PrimValue closed;
+    };
+
     class FunctionObject : public GCObject {
     public:
         FunctionObject() = default;
 
+        FunctionObject(size_t begin_offset, size_t module_id, size_t arity, bool is_method)
+            : is_native(false), is_method(is_method), native_function(nullptr), arity(arity),
+              begin_offset(begin_offset), module_id(module_id) {}
+
         std::string to_string() const override {
             return "[function object]";
         }
@@ -491,27 +957,11 @@ namespace luaxc {
         }
 
         static FunctionObject* create_function(size_t begin_offset, size_t module_id, size_t arity) {
-            auto* func = new FunctionObject();
-            func->is_native = false;
-            func->is_method = false;
-            func->native_function = nullptr;
-            func->arity = arity;
-
-            func->begin_offset = begin_offset;
-            func->module_id = module_id;
-            return func;
+            return new FunctionObject(begin_offset, module_id, arity, false);
         }
 
         static FunctionObject* create_method(size_t begin_offset, size_t module_id, size_t arity) {
-            auto* func = new FunctionObject();
-            func->is_native = false;
-            func->is_method = true;
-            func->native_function = nullptr;
-            func->arity = arity;
-
-            func->begin_offset = begin_offset;
-            func->module_id = module_id;
-            return func;
+            return new FunctionObject(begin_offset, module_id, arity, true);
         }
 
         bool is_native_function() const { return is_native; }
@@ -526,16 +976,27 @@ namespace luaxc {
 
         size_t get_arity() const { return arity; }
 
+        void set_local_slot_names(LocalSlotNames names) { this->local_slot_names = std::move(names); }
+
+        const LocalSlotNames& get_local_slot_names() const { return local_slot_names; }
+
         void set_context(FrozenContextObject* ctx) { this->ctx = ctx; }
 
         FrozenContextObject* get_context() const { return ctx; }
 
-        size_t get_object_size() const override {
-            // we don't care about the size of the context
-            return sizeof(FunctionObject);
-        }
+        // null for closures, names come from the string pool
+        void set_name(StringObject* name) { this->name = name; }
 
-        std::vector<GCObject*> get_referenced_objects() const override;
+        StringObject* get_name() const { return name; }
+
+        void add_upvalue(UpvalueObject* upvalue) { upvalues.push_back(upvalue); }
+
+        UpvalueObject* get_upvalue(size_t index) const { return upvalues[index]; }
+
+        // the context is an object of its own, and the state of native functions is out of reach
+        size_t get_owned_size() const override { return GCObject::get_owned_size() + allocated_size(upvalues); }
+
+        void trace(GCVisitor& visitor) const override;
 
     private:
         bool is_native;
@@ -546,12 +1007,18 @@ namespace luaxc {
         size_t begin_offset;
         size_t module_id;
 
-        FrozenContextObject* ctx;
+        LocalSlotNames local_slot_names = nullptr;
+
+        StringObject* name = nullptr;
+
+        FrozenContextObject* ctx = nullptr;
+
+        std::vector<UpvalueObject*> upvalues;
     };
 
     class ArrayObject : public GCObject {
     public:
-        std::vector<GCObject*> get_referenced_objects() const override;
+        void trace(GCVisitor& visitor) const override;
 
         ArrayObject(size_t size, TypeObject* element_type)
             : data(new PrimValue[size]), size(size),
@@ -587,7 +1054,7 @@ namespace luaxc {
 
         TypeObject* get_element_type() const { return element_type_info; }
 
-        size_t get_object_size() const override;
+        size_t get_owned_size() const override;
 
     private:
         PrimValue* data;
@@ -596,20 +1063,37 @@ namespace luaxc {
         TypeObject* element_type_info;
     };
 
-    class RuleObject : public GCObject {
+    // a growable buffer to build a string from many pieces, copied once when built
+    class StringBuilderObject : public GCObject {
     public:
-        std::vector<GCObject*> get_referenced_objects() const override {
-            std::vector<GCObject*> referenced_objects;
+        std::string to_string() const override { return "[string builder]"; }
+
+        void append(std::string_view piece) { buffer.insert(buffer.end(), piece.begin(), piece.end()); }
+
+        std::string_view view() const { return {buffer.data(), buffer.size()}; }
 
+        char* get_data() { return buffer.data(); }
+
+        size_t get_length() const { return buffer.size(); }
+
+        void clear() { buffer.clear(); }
+
+        size_t get_owned_size() const override { return GCObject::get_owned_size() + allocated_size(buffer); }
+
+    private:
+        std::vector<char> buffer;
+    };
+
+    class RuleObject : public GCObject {
+    public:
+        void trace(GCVisitor& visitor) const override {
             for (auto& [identifier, constraint]: constraints) {
-                referenced_objects.push_back(identifier);
-                referenced_objects.push_back(constraint);
+                visitor.visit(identifier);
+                visitor.visit(constraint);
             }
-
-            return referenced_objects;
         }
 
-        size_t get_object_size() const override { return sizeof(RuleObject); }
+        size_t get_owned_size() const override { return GCObject::get_owned_size() + allocated_size(constraints); }
 
         std::string to_string() const override { return "[rule object]"; }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ir.hpp"
+#include "string_kernels.hpp"
 #include "test_helper.hpp"
 
 namespace parser_test {
@@ -10,7 +11,7 @@ namespace parser_test {
         runtime.compile(input);
 
         auto byte_code = runtime.get_byte_code();
-        std::cout << luaxc::dump_bytecode(byte_code) << std::endl;
+        std::cout << luaxc::dump_bytecode(byte_code, runtime.get_constant_tables()) << std::endl;
 
         runtime.run();
 
@@ -112,6 +113,28 @@ namespace parser_test {
         assert(runtime.retrieve_value<luaxc::Int>("a") == 0);
     }
 
+    inline void test_if_statement_short_circuit() {
+        std::string input = R"(
+        let calls = 0;
+        func touch(v) { calls = calls + 1; return v; }
+
+        let a = false && touch(true);
+        let b = true || touch(false);
+        let c = true && touch(1);
+        let hits = 0;
+        for (let i = 0; i < 10; i += 1) {
+            if ((i > 2 && i < 5) || i == 8 || touch(false)) { hits = hits + 1; }
+        }
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Bool>("a") == false);
+        assert(runtime.retrieve_value<luaxc::Bool>("b") == true);
+        assert(runtime.retrieve_value<luaxc::Bool>("c") == true);
+        assert(runtime.retrieve_value<luaxc::Int>("hits") == 3);
+        assert(runtime.retrieve_value<luaxc::Int>("calls") == 8);
+    }
+
     inline void test_while_statement() {
         auto runtime =
                 compile_run("let a = 0; while (a < 10) { a = a + 1; }");
@@ -380,6 +403,75 @@ namespace parser_test {
         assert(runtime.retrieve_value<luaxc::Int>("result") == 3);
     }
 
+    inline void test_function_locals() {
+        std::string input = R"(
+        let a = 10;
+        let result;
+        let captured;
+        func main(x) {
+            let before = a;
+            let a = x;
+            for (let i = 0; i < 3; i += 1) {
+                a += i;
+            }
+            let fn = func() { return a + x; };
+            captured = fn;
+            result = before + a;
+        }
+
+        main(1);
+        captured = captured();
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("result") == 14);
+        assert(runtime.retrieve_value<luaxc::Int>("captured") == 5);
+    }
+
+    inline void test_closure_upvalues() {
+        std::string input = R"(
+        func outer(a) {
+            let b = a + 1;
+            let mid = func(c) {
+                return func(d) { return a * 1000 + b * 100 + c * 10 + d; };
+            };
+            let live = func() { return b; };
+            b = 5;
+            let seen = live();
+            return func(c) { return mid(c)(seen); };
+        }
+
+        let result = outer(1)(3);
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("result") == 1535);
+    }
+
+    inline void test_binary_op_quickening() {
+        std::string input = R"(
+        func add(a, b) { return a + b; }
+        func less(a, b) { return a < b; }
+
+        let ints = 0;
+        let floats = 0.0;
+        let mixed = 0;
+        for (let i = 0; i < 10; i += 1) {
+            ints = add(ints, i);
+            floats = add(floats, 0.5);
+            if (less(i, 5)) { mixed = add(mixed, 1); }
+            if (less(0.5, i)) { mixed = add(mixed, 1); }
+        }
+        let after = add(ints, 1);
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("ints") == 45);
+        assert(runtime.retrieve_value<luaxc::Float>("floats") == 5.0);
+        assert(runtime.retrieve_value<luaxc::Int>("mixed") == 14);
+        assert(runtime.retrieve_value<luaxc::Int>("after") == 46);
+    }
+
     inline void test_string_literal() {
         std::string input = R"(
         use println;
@@ -390,6 +482,136 @@ namespace parser_test {
         auto runtime = compile_run(input);
     }
 
+    inline void test_string_literals_are_shared() {
+        std::string input = R"(
+        let first = "abc";
+        let last;
+        for (let i = 0; i < 100; i += 1) {
+            last = "abc";
+        }
+        )";
+
+        // every evaluation of a literal yields the same immutable string
+        auto runtime = compile_run(input);
+        auto* first = runtime.retrieve_value<luaxc::GCObject*>("first");
+        auto* last = runtime.retrieve_value<luaxc::GCObject*>("last");
+        assert(first == last);
+        assert(!static_cast<luaxc::StringObject*>(first)->is_mutable());
+    }
+
+    inline void test_short_strings_are_inline() {
+        auto runtime = compile_run(R"(let c = "a";)");
+
+        // single characters come from the pool, the same as literals
+        assert(runtime.retrieve_value<luaxc::GCObject*>("c") == runtime.get_single_byte_string('a'));
+
+        // up to 15 characters fit into the object, one more needs contents of its own
+        auto inline_string = luaxc::StringObject(std::string(15, 'x'));
+        auto outline_string = luaxc::StringObject(std::string(16, 'x'));
+        assert(inline_string.get_owned_size() == inline_string.GCObject::get_owned_size());
+        assert(outline_string.get_owned_size() > outline_string.GCObject::get_owned_size());
+
+        auto short_string = luaxc::StringObject(std::string("short"));
+        auto joined = luaxc::StringObject(short_string, short_string);
+        auto copy = luaxc::StringObject(joined);
+        copy.get_data()[0] = 'S';
+        assert(joined.contained_string() == "shortshort");
+        assert(copy.contained_string() == "Shortshort");
+        assert(joined.get_owned_size() == copy.get_owned_size());
+    }
+
+    inline void test_ropes_and_string_builder() {
+        // every piece is appended to the whole string so far, the rope is as deep as the loop is long
+        auto piece = luaxc::StringObject(std::string("abc"));
+        std::string expected = "abc";
+        auto rope = std::unique_ptr<luaxc::StringObject>(new luaxc::StringObject(piece));
+        for (int i = 1; i < 100000; i++) {
+            rope.reset(*rope + piece);
+            expected += "abc";
+        }
+        assert(rope->is_rope());
+
+        assert(rope->view()[0] == 'a');
+        assert(rope->view()[150001] == 'b');
+        assert(rope->view()[299999] == 'c');
+        assert(!rope->is_rope());
+
+        // the hash and the comparison a map keyed by contents would use
+        auto flat = luaxc::StringObject(expected);
+        auto twin = std::unique_ptr<luaxc::StringObject>(flat + piece);
+        auto other = std::unique_ptr<luaxc::StringObject>(*rope + piece);
+        assert(other->is_rope());
+        assert(other->get_hash() == twin->get_hash());
+        assert(*other == *twin);
+
+        // a substring shares the contents of the rope, and is copied to be terminated
+        auto middle = luaxc::StringObject(*rope, 3, 90);
+        assert(std::strlen(middle.c_str()) == 90);
+        assert(middle.contained_string() == expected.substr(3, 90));
+        assert(rope->contained_string() == expected);
+
+        auto runtime = compile_run(R"(
+        func __builtin_strings_builder();
+
+        let b = __builtin_strings_builder();
+        for (let i = 0; i < 100; i += 1) {
+            b.append("ab");
+        }
+        b[0] = "X";
+        b[199] = "Y";
+
+        let first = b[0];
+        let size = b.size();
+        let built = b.build();
+        b[1] = "Z";
+        )");
+
+        assert(runtime.retrieve_value<luaxc::GCObject*>("first") == runtime.get_single_byte_string('X'));
+        assert(runtime.retrieve_value<luaxc::Int>("size") == 200);
+
+        // built strings do not change with the builder
+        std::string built = "X";
+        for (int i = 1; i < 199; i++) {
+            built += i % 2 == 0 ? 'a' : 'b';
+        }
+        built += 'Y';
+        assert(static_cast<luaxc::StringObject*>(runtime.retrieve_value<luaxc::GCObject*>("built"))->contained_string() == built);
+    }
+
+    inline void test_string_kernels() {
+        namespace kernels = luaxc::string_kernels;
+
+        // lengths around the 16 and 32 byte blocks, over a small alphabet to get many partial matches
+        uint32_t seed = 42;
+        auto next_char = [&seed]() {
+            seed = seed * 1664525 + 1013904223;
+            return char('a' + (seed >> 24) % 3);
+        };
+
+        for (size_t length = 0; length < 100; length++) {
+            std::string haystack;
+            for (size_t i = 0; i < length; i++) {
+                haystack += next_char();
+            }
+
+            for (auto needle: {"a", "ab", "abc", "cab", "abca", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"}) {
+                auto view = std::string_view(haystack);
+                for (size_t from = 0; from <= length; from += 7) {
+                    assert(kernels::find(view, needle, from) == view.find(needle, from));
+                    assert(kernels::rfind(view, needle, from) == view.rfind(needle, from));
+                }
+                assert(kernels::rfind(view, needle) == view.rfind(needle));
+            }
+
+            auto upper = haystack + "zZ{`@\xe4";
+            kernels::to_upper(upper.data(), upper.data(), upper.length());
+            for (size_t i = 0; i < length; i++) {
+                assert(upper[i] == haystack[i] - 'a' + 'A');
+            }
+            assert(upper.substr(length) == "ZZ{`@\xe4");
+        }
+    }
+
     inline void test_type_decl() {
         std::string input = R"(
         use println;
@@ -508,6 +730,246 @@ namespace parser_test {
         assert(runtime.retrieve_value<luaxc::Int>("z") == 2);
     }
 
+    inline void test_object_member_access_polymorphic() {
+        std::string input = R"(
+        func sum(o) {
+            o.x = o.x + 1;
+            return o.x + o.y;
+        }
+
+        let total = 0;
+        for (let i = 0; i < 6; i += 1) {
+            total += sum({ x = 1, y = 2 });
+            total += sum({ y = 2, x = 1 });
+            total += sum({ z = 0, x = 1, y = 2 });
+            total += sum({ w = 0, z = 0, y = 2, x = 1 });
+            total += sum({ v = 0, x = 1, y = 2 });
+        }
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("total") == 120);
+    }
+
+    inline void test_method_lookup_through_type() {
+        std::string input = R"(
+        let Counter = type {
+            method get(self) { return 7; }
+        };
+
+        let a = Counter {};
+        let b = Counter {};
+        let result = a.get() + b.get();
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("result") == 14);
+    }
+
+    inline void test_method_override_on_instance() {
+        std::string input = R"(
+        let Value = type {};
+        let P = type {
+            field x = Value;
+            method get(self) { return self.x; }
+        };
+
+        let p = P { x = 4 };
+        let q = P { x = 5 };
+        p.get = func(self) { return 100; };
+
+        let overridden = p.get();
+        let other = q.get();
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("overridden") == 100);
+        assert(runtime.retrieve_value<luaxc::Int>("other") == 5);
+    }
+
+    inline void test_object_field_survives_minor_collections() {
+        std::string input = R"(
+        let holder = { item = { value = 0 } };
+
+        func churn(n) {
+            for (let i = 0; i < n; i += 1) {
+                let t = { value = i };
+            }
+        }
+
+        churn(20000);
+        for (let i = 1; i <= 5; i += 1) {
+            holder.item = { value = i };
+            churn(20000);
+        }
+
+        let result = holder.item.value;
+        )";
+
+        auto runtime = compile_run(input);
+        assert(runtime.retrieve_value<luaxc::Int>("result") == 5);
+    }
+
+    inline void test_deep_list_survives_full_collection() {
+        std::string input = R"(
+        let head = { value = 0, next = null };
+        for (let i = 1; i < 100000; i += 1) {
+            head = { value = i, next = head };
+        }
+
+        let result = head.next.value;
+        )";
+
+        auto runtime = compile_run(input);
+
+        // tracing a long chain must not recurse once per link
+        runtime.gc_collect();
+        assert(runtime.get_gc().dump_stats().object_count >= 100000);
+        assert(runtime.retrieve_value<luaxc::Int>("result") == 99998);
+    }
+
+    inline void test_objects_moved_during_incremental_marking() {
+        std::string input = R"(
+        let ballast = null;
+        for (let i = 0; i < 10000; i += 1) {
+            ballast = { value = i, next = ballast };
+        }
+
+        let sources = null;
+        let holders = null;
+        for (let i = 1; i <= 1000; i += 1) {
+            sources = { item = { value = i }, next = sources };
+            holders = { item = { value = i }, next = holders };
+        }
+
+        for (let phase = 0; phase < 400; phase += 1) {
+            for (let i = 0; i < 1000; i += 1) {
+                let garbage = { value = i };
+            }
+
+            // nothing is allocated while the items change places, a marking slice in between
+            // may have traced one list and not the other
+            let s = sources;
+            let h = holders;
+            for (let i = 0; i < 1000; i += 1) {
+                let t = h.item;
+                h.item = s.item;
+                s.item = t;
+                h = h.next;
+                s = s.next;
+            }
+        }
+
+        let sum = 0;
+        let s = sources;
+        let h = holders;
+        for (let i = 0; i < 1000; i += 1) {
+            sum += h.item.value + s.item.value;
+            h = h.next;
+            s = s.next;
+        }
+        )";
+
+        auto runtime = luaxc::IRRuntime();
+        // a microsecond per slice keeps full collections in progress while the items move,
+        // the heap is always above the goal so they follow each other
+        runtime.get_gc().set_pause_budget(1);
+        runtime.get_gc().set_gc_percent(1);
+        runtime.compile(input);
+        runtime.run();
+
+        auto stats = runtime.get_gc().dump_stats();
+        assert(stats.full_collections >= 1);
+        // marking slices are pauses of their own
+        assert(runtime.get_gc().get_telemetry().get_pauses().get_count() > stats.full_collections + stats.minor_collections);
+        assert(runtime.retrieve_value<luaxc::Int>("sum") == 1000 * 1001);
+    }
+
+    inline void test_module_binding_survives_full_collections() {
+        std::string input = R"(
+        let M = mod {
+            let kept = { value = 7, next = { value = 35 } };
+        };
+
+        for (let i = 0; i < 50000; i += 1) {
+            let garbage = { value = i };
+        }
+        )";
+
+        auto runtime = compile_run(input);
+
+        // modules are immortal, the object is only reachable through the module's fields
+        for (int i = 0; i < 3; i++) {
+            runtime.gc_collect();
+        }
+
+        auto* module = runtime.retrieve_value<luaxc::GCObject*>("M");
+        auto* kept = module->find_field(runtime.push_string_pool_if_not_exists("kept"))->get_inner_value<luaxc::GCObject*>();
+        auto* next = kept->find_field(runtime.push_string_pool_if_not_exists("next"))->get_inner_value<luaxc::GCObject*>();
+        auto* value = runtime.push_string_pool_if_not_exists("value");
+        assert(kept->find_field(value)->get_inner_value<luaxc::Int>() == 7);
+        assert(next->find_field(value)->get_inner_value<luaxc::Int>() == 35);
+
+        // nothing was allocated since the last collection, it kept every mortal object and marked none of
+        // the immortal ones: the module, the symbols and the builtin types
+        auto& last = runtime.get_gc().get_telemetry().get_last_collection();
+        assert(last.freed_objects == 0);
+        assert(last.marked_objects >= 2);
+        assert(last.marked_objects < runtime.get_gc().dump_stats().object_count);
+    }
+
+    inline void test_untyped_objects_across_runtimes() {
+        std::string input = R"(
+        let point = { x = 1, y = 2 };
+        point.x = point.y + 40;
+        let result = point.x;
+        )";
+
+        // untyped objects of both runtimes share the shapes of the static Any type,
+        // which works because both runtimes name the fields with the same symbols
+        auto first = compile_run(input);
+        auto second = compile_run(input);
+        assert(first.retrieve_value<luaxc::Int>("result") == 42);
+        assert(second.retrieve_value<luaxc::Int>("result") == 42);
+        assert(first.push_string_pool_if_not_exists("x") == second.push_string_pool_if_not_exists("x"));
+    }
+
+    inline void test_gc_telemetry_records_collections() {
+        std::string input = R"(
+        let keep = null;
+        for (let i = 0; i < 50000; i += 1) {
+            let garbage = { value = i };
+            if (i % 10 == 0) {
+                keep = { value = i, next = keep };
+            }
+        }
+        )";
+
+        auto runtime = compile_run(input);
+        runtime.gc_collect();
+
+        auto& telemetry = runtime.get_gc().get_telemetry();
+        auto& last = telemetry.get_last_collection();
+        assert(last.full);
+        assert(last.marked_objects >= 5000);
+        assert(last.survival_ratio > 0.0 && last.survival_ratio <= 1.0);
+        assert(telemetry.get_full_pauses().get_count() >= 1);
+        assert(telemetry.get_pauses().get_count() >= telemetry.get_full_pauses().get_count());
+        assert(telemetry.get_pauses().get_percentile(50) <= telemetry.get_pauses().get_max());
+    }
+
+    inline void test_gc_percent_saturates_heap_goal() {
+        auto runtime = compile_run("let keep = { value = 1 };");
+        auto& gc = runtime.get_gc();
+
+        // the goal would wrap around to below the live heap
+        gc.set_gc_percent(SIZE_MAX);
+        assert(gc.dump_stats().heap_goal == gc.get_max_heap_size());
+
+        gc.set_gc_percent(100);
+        assert(gc.dump_stats().heap_goal < gc.get_max_heap_size());
+    }
+
     inline void test_object_return_from_func() {
         std::string input = R"(
         use println;
@@ -611,6 +1073,10 @@ namespace parser_test {
             test(test_unary_operator_minus);
             test(test_combinative_assignment);
             test(test_string_literal)
+            test(test_string_literals_are_shared)
+            test(test_short_strings_are_inline)
+            test(test_ropes_and_string_builder)
+            test(test_string_kernels)
         }
         end_test();
 
@@ -623,6 +1089,7 @@ namespace parser_test {
             test(test_if_statement_const_false_condition);
             test(test_if_statement_const_expr_condition);
             test(test_if_statement_const_expr_false_condition);
+            test(test_if_statement_short_circuit);
         }
         end_test();
 
@@ -656,6 +1123,9 @@ namespace parser_test {
             test(test_multiple_function_declarations);
             test(test_deferred_function_declarations);
             test(test_nested_function_declaration);
+            test(test_function_locals);
+            test(test_closure_upvalues);
+            test(test_binary_op_quickening);
         }
         end_test();
 
@@ -666,6 +1136,16 @@ namespace parser_test {
             test(test_object_member_access_basic);
             test(test_object_member_access_nested);
             test(test_object_member_access_anonymous);
+            test(test_object_member_access_polymorphic);
+            test(test_method_lookup_through_type);
+            test(test_method_override_on_instance);
+            test(test_object_field_survives_minor_collections);
+            test(test_deep_list_survives_full_collection);
+            test(test_module_binding_survives_full_collections);
+            test(test_objects_moved_during_incremental_marking);
+            test(test_gc_telemetry_records_collections);
+            test(test_gc_percent_saturates_heap_goal);
+            test(test_untyped_objects_across_runtimes);
             test(test_object_return_from_func);
             test(test_generic_type_object);
             test(test_method);